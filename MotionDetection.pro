@@ -1,16 +1,28 @@
-QT += core gui multimedia multimediawidgets
+QT += core gui multimedia multimediawidgets network
 greaterThan(QT_MAJOR_VERSION, 5): QT += multimediawidgets
 CONFIG += c++17
 
 SOURCES += main.cpp \
            mainwindow.cpp \
            motiondetector.cpp \
-           cameramanager.cpp
+           cameramanager.cpp \
+           rawframefile.cpp \
+           replaysource.cpp \
+           mjpegserver.cpp \
+           shmring/framering.cpp
 
 HEADERS += \
     mainwindow.h \
     motiondetector.h \
-    cameramanager.h
+    cameramanager.h \
+    framesource.h \
+    rawframefile.h \
+    replaysource.h \
+    mjpegserver.h \
+    shmring/framering.h
+
+INCLUDEPATH += shmring
+unix:!macx: LIBS += -lrt
 
 FORMS += \
     mainwindow.ui
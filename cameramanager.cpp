@@ -9,16 +9,33 @@
 #include <QAudioInput>
 #include <QCameraDevice>
 #include <QMediaFormat>
-
-CameraManager::CameraManager(QObject *parent) : QObject(parent)
+#include <QThread>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QDir>
+#include <QFileInfo>
+#include <QDebug>
+
+CameraManager::CameraManager(QObject *parent) : FrameSource(parent)
 {
     m_camera = nullptr;
     m_imageCapture = nullptr;
     m_captureSession = new QMediaCaptureSession(this);
     m_mediaRecorder = nullptr;
     m_videoSink = new QVideoSink(this);
+    m_startPending = false;
+    m_firstFrameSeen = false;
 
     connect(m_videoSink, &QVideoSink::videoFrameChanged, this, &CameraManager::onVideoFrameChanged);
+
+    // device probing runs on its own thread with an event loop, QMediaDevices
+    // creates its device watcher on the thread that first asks it and that
+    // watcher needs a running loop to see cameras being plugged in
+    m_probeThread = new QThread(this);
+    m_probeContext = new QObject;
+    m_probeContext->moveToThread(m_probeThread);
+    connect(m_probeThread, &QThread::finished, m_probeContext, &QObject::deleteLater);
+    m_probeThread->start();
 }
 
 CameraManager::~CameraManager()
@@ -26,29 +43,100 @@ CameraManager::~CameraManager()
     if (m_camera) {
         m_camera->stop();
     }
+    m_probeThread->quit();
+    m_probeThread->wait();
 }
 
-void CameraManager::start()
+QString CameraManager::probeCachePath()
 {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/camera-probe.ini";
+}
+
+// runs on the probe thread. Qt has no way to open a camera without enumerating
+// the devices, but a device seen before gets its remembered format back
+// without judging its format list again
+CameraProbeResult CameraManager::probeDefaultCamera(const QString &cachePath)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    CameraProbeResult result;
     QList<QCameraDevice> cameras = QMediaDevices::videoInputs();
-    if (cameras.isEmpty()) {
-        emit cameraReady(false);
-        return;
+    if (cameras.isEmpty())
+        return result;
+    result.device = cameras.first();
+    const QList<QCameraFormat> formats = result.device.videoFormats();
+
+    QSettings cache(cachePath, QSettings::IniFormat);
+    cache.beginGroup(QString::fromLatin1(result.device.id().toHex()));
+    const int cachedIndex = cache.value("formatIndex", -1).toInt();
+    if (cachedIndex >= 0 && cachedIndex < formats.size()) {
+        // the index only counts if the format there is still the one we chose
+        const QCameraFormat &format = formats.at(cachedIndex);
+        if (format.resolution() == cache.value("resolution").toSize() &&
+            int(format.pixelFormat()) == cache.value("pixelFormat").toInt()) {
+            result.format = format;
+            result.fromCache = true;
+        }
     }
+    cache.endGroup();
 
-    m_camera = new QCamera(cameras.first(), this);
-
-    QCameraFormat bestFormat;
-    const QList<QCameraFormat> formats = cameras.first().videoFormats();
-    if (!formats.isEmpty()) {
+    if (!result.fromCache) {
         for (const QCameraFormat &format : formats) {
             if (format.resolution().width() <= 640 && format.resolution().height() <= 480) {
-                bestFormat = format;
+                result.format = format;
                 break;
             }
         }
-        if (!bestFormat.isNull())
-            m_camera->setCameraFormat(bestFormat);
+    }
+    result.probeMs = timer.elapsed();
+    return result;
+}
+
+void CameraManager::setStartupTimer(const QElapsedTimer &timer)
+{
+    m_startupTimer = timer;
+}
+
+void CameraManager::start()
+{
+    if (m_startPending || m_camera)
+        return;
+    if (!m_startupTimer.isValid())
+        m_startupTimer.start();
+    m_firstFrameSeen = false;
+    // enumerating devices can take seconds with several usb cameras, the
+    // window keeps painting meanwhile
+    m_startPending = true;
+    const QString cachePath = probeCachePath();
+    QMetaObject::invokeMethod(m_probeContext, [this, cachePath]() {
+        const CameraProbeResult probe = probeDefaultCamera(cachePath);
+        QMetaObject::invokeMethod(this, [this, probe]() { openCamera(probe); }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+void CameraManager::openCamera(const CameraProbeResult &probe)
+{
+    m_startPending = false;
+    if (probe.device.isNull()) {
+        emit cameraReady(false);
+        return;
+    }
+    qDebug() << "camera probe took" << probe.probeMs << "ms" << (probe.fromCache ? "(cached format)" : "(full probe)");
+
+    m_camera = new QCamera(probe.device, this);
+    if (!probe.format.isNull()) {
+        m_camera->setCameraFormat(probe.format);
+        if (!probe.fromCache) {
+            QDir().mkpath(QFileInfo(probeCachePath()).absolutePath());
+            QSettings cache(probeCachePath(), QSettings::IniFormat);
+            cache.beginGroup(QString::fromLatin1(probe.device.id().toHex()));
+            cache.setValue("description", probe.device.description());
+            cache.setValue("formatIndex", probe.device.videoFormats().indexOf(probe.format));
+            cache.setValue("resolution", probe.format.resolution());
+            cache.setValue("pixelFormat", int(probe.format.pixelFormat()));
+            cache.endGroup();
+        }
     }
 
     m_imageCapture = new QImageCapture(this);
@@ -66,6 +154,13 @@ void CameraManager::start()
     emit cameraReady(true);
 }
 
+void CameraManager::stop()
+{
+    if (m_camera) {
+        m_camera->stop();
+    }
+}
+
 void CameraManager::captureImage()
 {
     if (m_imageCapture && m_imageCapture->isReadyForCapture()) {
@@ -109,6 +204,10 @@ bool CameraManager::isRecording() const
 
 void CameraManager::onVideoFrameChanged(const QVideoFrame &frame)
 {
+    if (!m_firstFrameSeen) {
+        m_firstFrameSeen = true;
+        qDebug() << "first camera frame" << m_startupTimer.elapsed() << "ms after process start";
+    }
     emit frameAvailable(frame);
 }
 
@@ -1,31 +1,44 @@
 #ifndef CAMERAMANAGER_H
 #define CAMERAMANAGER_H
 
-#include <QObject>
+#include "framesource.h"
 #include <QVideoFrame>
 #include <QImage>
+#include <QElapsedTimer>
+#include <QCameraDevice>
+#include <QCameraFormat>
 
 class QCamera;
 class QImageCapture;
 class QMediaCaptureSession;
 class QMediaRecorder;
 class QVideoSink;
+class QThread;
 
-class CameraManager : public QObject
+struct CameraProbeResult
+{
+    QCameraDevice device;
+    QCameraFormat format;
+    bool fromCache = false;
+    qint64 probeMs = 0;
+};
+
+class CameraManager : public FrameSource
 {
     Q_OBJECT
 public:
     explicit CameraManager(QObject *parent = nullptr);
     ~CameraManager();
 
-    void start();
+    void setStartupTimer(const QElapsedTimer &timer);
+    void start() override;
+    void stop() override;
     void captureImage();
     bool startRecording(const QUrl &outputUrl);
     void stopRecording();
     bool isRecording() const;
 
 signals:
-    void frameAvailable(const QVideoFrame &frame);
     void imageCaptured(int id, const QImage &preview);
     void cameraReady(bool ready);
     void recorderError(const QString &errorString);
@@ -36,11 +49,20 @@ private slots:
     void onRecorderError();
 
 private:
+    static CameraProbeResult probeDefaultCamera(const QString &cachePath);
+    static QString probeCachePath();
+    void openCamera(const CameraProbeResult &probe);
+
     QCamera *m_camera;
     QImageCapture *m_imageCapture;
     QMediaCaptureSession *m_captureSession;
     QMediaRecorder *m_mediaRecorder;
     QVideoSink *m_videoSink;
+    QThread *m_probeThread;
+    QObject *m_probeContext;
+    QElapsedTimer m_startupTimer;
+    bool m_startPending;
+    bool m_firstFrameSeen;
 };
 
 #endif // CAMERAMANAGER_H
@@ -0,0 +1,23 @@
+#ifndef FRAMESOURCE_H
+#define FRAMESOURCE_H
+
+#include <QObject>
+#include <QVideoFrame>
+
+// common base for anything that feeds frames into the pipeline
+// (the live camera, a replayed dump file, ...)
+class FrameSource : public QObject
+{
+    Q_OBJECT
+public:
+    explicit FrameSource(QObject *parent = nullptr) : QObject(parent) {}
+
+    virtual void start() = 0;
+    virtual void stop() = 0;
+
+signals:
+    void frameAvailable(const QVideoFrame &frame);
+    void finished();
+};
+
+#endif // FRAMESOURCE_H
@@ -1,11 +1,83 @@
 #include "mainwindow.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QDebug>
 
 int main(int argc, char *argv[])
 {
+    // camera cold start is measured from here to the first frame
+    QElapsedTimer startupTimer;
+    startupTimer.start();
+
     QApplication a(argc, argv);
+    QApplication::setApplicationName("Motion Detector Camera");
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption replayOption("replay", "Play frames from a raw frame dump instead of the camera.", "file");
+    QCommandLineOption fastOption("fast", "Replay as fast as frames can be processed instead of at the recorded pace.");
+    QCommandLineOption quitOption("quit-at-end", "Exit once the replay has finished.");
+    QCommandLineOption dumpOption("dump", "Write every incoming raw frame to a frame dump.", "file");
+    QCommandLineOption httpOption("http-port", "Serve the processed feed as MJPEG on /stream and the motion state on /status.", "port");
+    QCommandLineOption httpBindOption("http-bind", "Address the http server listens on (default 127.0.0.1, use 0.0.0.0 to expose it to the network).", "address", "127.0.0.1");
+    QCommandLineOption ringOption("shm-ring", "Publish processed frames and motion rectangles to a shared memory ring.", "name");
+    QCommandLineOption displayFpsOption("display-fps", "How often the window is repainted, independent of the analysis rate (default 30).", "fps", "30");
+    QCommandLineOption blockSizeOption("block-size", "Detection block size in pixels, a multiple of 8 (default 16).", "pixels", "16");
+    QCommandLineOption shiftedGridOption("shifted-grid", "Also test blocks shifted by half a block to catch objects on block edges.");
+    QCommandLineOption scalesOption("scales", "Comma separated block size multiples to test at once, e.g. 1,2,4.", "list", "1");
+    QCommandLineOption sceneChangeOption("scene-change", "Fraction of changed blocks above which a frame counts as a lighting change, not motion (default 0.6, 0 disables).", "fraction", "0.6");
+    QCommandLineOption gainOption("gain-compensation", "Retry lighting changes with the brightness difference compensated before discarding them.");
+    parser.addOptions({ replayOption, fastOption, quitOption, dumpOption, httpOption, httpBindOption, ringOption,
+                        displayFpsOption, blockSizeOption, shiftedGridOption, scalesOption,
+                        sceneChangeOption, gainOption });
+    parser.process(a);
+
     MainWindow w;
+    bool ok = false;
+    double sceneChange = parser.value(sceneChangeOption).toDouble(&ok);
+    if (!ok || sceneChange < 0.0 || sceneChange > 1.0) {
+        qWarning() << "invalid --scene-change" << parser.value(sceneChangeOption) << ", expected 0 to 1, using 0.6";
+        sceneChange = 0.6;
+    }
+    w.configureSceneChange(sceneChange, parser.isSet(gainOption));
+    w.setDisplayRate(parser.value(displayFpsOption).toInt());
+    int blockSize = parser.value(blockSizeOption).toInt(&ok);
+    if (!ok || blockSize <= 0) {
+        qWarning() << "invalid --block-size" << parser.value(blockSizeOption) << ", using 16";
+        blockSize = 16;
+    }
+    QVector<int> scales;
+    for (const QString &scale : parser.value(scalesOption).split(',', Qt::SkipEmptyParts)) {
+        const int value = scale.trimmed().toInt(&ok);
+        if (ok)
+            scales.append(value);
+        else
+            qWarning() << "ignoring invalid --scales entry" << scale;
+    }
+    w.configureDetectorGrid(blockSize, parser.isSet(shiftedGridOption), scales);
+    if (parser.isSet(replayOption)) {
+        if (!w.startReplay(parser.value(replayOption), !parser.isSet(fastOption), parser.isSet(quitOption))
+            && parser.isSet(quitOption))
+            return 1;
+    } else {
+        w.startCamera(startupTimer);
+    }
+    if (parser.isSet(dumpOption))
+        w.startFrameDump(parser.value(dumpOption));
+    if (parser.isSet(httpOption)) {
+        quint16 port = parser.value(httpOption).toUShort(&ok);
+        QHostAddress address;
+        if (!ok || port == 0)
+            qWarning() << "invalid --http-port" << parser.value(httpOption) << ", http server disabled";
+        else if (!address.setAddress(parser.value(httpBindOption)))
+            qWarning() << "invalid --http-bind" << parser.value(httpBindOption) << ", http server disabled";
+        else
+            w.startHttpServer(address, port);
+    }
+    if (parser.isSet(ringOption))
+        w.startFrameRing(parser.value(ringOption));
     w.show();
     return a.exec();
 }
@@ -1,5 +1,9 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "replaysource.h"
+#include "rawframefile.h"
+#include "mjpegserver.h"
+#include "framering.h"
 #include <QPushButton>
 #include <QImage>
 #include <QFileDialog>
@@ -21,19 +25,31 @@
 #include <QSlider>
 #include <QLineEdit>
 #include <QDoubleValidator>
+#include <QIntValidator>
 #include <QStackedWidget>
+#include <QApplication>
+#include <QWindow>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
     ui(new Ui::MainWindow),
     grayscaleValue(0),
     showTimestamp(true),
+    overlayPending(false),
     processingFrame(false),
     updatePending(false),
     recordingSeconds(0),
     autoSaveEnabled(false),
     autoSavePending(false),
-    autoSaveInterval(30000) // 30 seconds default
+    autoSaveInterval(30000), // 30 seconds default
+    frameInterval(33),
+    displayInterval(33),
+    displayPending(false),
+    idleTimeout(60000),
+    modeBusyNs(0),
+    modeFrames(0),
+    replayFrames(0),
+    quitAfterReplay(false)
 {
     ui->setupUi(this);
     setWindowTitle("Motion Detector Camera");
@@ -42,6 +58,10 @@ MainWindow::MainWindow(QWidget *parent)
 
     m_motionDetector = new MotionDetector(this);
     m_cameraManager = new CameraManager(this);
+    m_replaySource = nullptr;
+    m_frameWriter = nullptr;
+    m_mjpegServer = nullptr;
+    m_frameRing = nullptr;
 
     videoScene = new QGraphicsScene(this);
     videoView = new QGraphicsView(videoScene, this);
@@ -81,6 +101,14 @@ MainWindow::MainWindow(QWidget *parent)
     autoSaveImageCheckbox->setChecked(false);
     connect(autoSaveImageCheckbox, &QCheckBox::checkStateChanged, this, &MainWindow::toggleAutoSaveMotionImages);
 
+    motionDirectionCheckbox = new QCheckBox("Direction", this);
+    motionDirectionCheckbox->setChecked(false);
+    connect(motionDirectionCheckbox, &QCheckBox::checkStateChanged, this, &MainWindow::toggleMotionDirection);
+
+    lowPowerCheckbox = new QCheckBox("Low Power Idle", this);
+    lowPowerCheckbox->setChecked(false);
+    connect(lowPowerCheckbox, &QCheckBox::checkStateChanged, this, &MainWindow::toggleLowPowerIdle);
+
     // row 1
     QHBoxLayout *controlsLayout = new QHBoxLayout;
     controlsLayout->setSpacing(30);
@@ -143,6 +171,7 @@ MainWindow::MainWindow(QWidget *parent)
     sensitivitySlider->setMaximumWidth(150);
     connect(sensitivitySlider, &QSlider::valueChanged, this, &MainWindow::setMotionSensitivity);
     motionControlsLayout->addWidget(sensitivitySlider);
+    motionControlsLayout->addWidget(motionDirectionCheckbox);
     motionControlsLayout->addStretch();
     layout->addLayout(motionControlsLayout);
 
@@ -172,6 +201,19 @@ MainWindow::MainWindow(QWidget *parent)
     currentIntervalLabel->setText(QString("(Current: %1s)").arg(QString::number(autoSaveInterval / 1000.0, 'f', 1)));
     autoSaveControlsLayout->addWidget(currentIntervalLabel);
 
+    autoSaveControlsLayout->addWidget(lowPowerCheckbox);
+
+    QLabel *idleTimeoutLabel = new QLabel("Idle After (s):", this);
+    autoSaveControlsLayout->addWidget(idleTimeoutLabel);
+
+    idleTimeoutEdit = new QLineEdit(this);
+    idleTimeoutEdit->setText(QString::number(idleTimeout / 1000));
+    idleTimeoutEdit->setPlaceholderText("5 - 3600");
+    idleTimeoutEdit->setFixedWidth(60);
+    idleTimeoutEdit->setValidator(new QIntValidator(5, 3600, this));
+    connect(idleTimeoutEdit, &QLineEdit::editingFinished, this, &MainWindow::validateAndSetIdleTimeout);
+    autoSaveControlsLayout->addWidget(idleTimeoutEdit);
+
     autoSaveControlsLayout->addStretch();
     layout->addLayout(autoSaveControlsLayout);
 
@@ -184,6 +226,11 @@ MainWindow::MainWindow(QWidget *parent)
     frameUpdateTimer->setSingleShot(true);
     connect(frameUpdateTimer, &QTimer::timeout, this, &MainWindow::processNextFrame);
 
+    // presentation runs on its own clock, independent of how often frames are analysed
+    displayTimer = new QTimer(this);
+    displayTimer->setSingleShot(true);
+    connect(displayTimer, &QTimer::timeout, this, &MainWindow::updateDisplay);
+
     recordingTimer = new QTimer(this);
     connect(recordingTimer, &QTimer::timeout, this, &MainWindow::updateRecordTime);
 
@@ -197,14 +244,146 @@ MainWindow::MainWindow(QWidget *parent)
     connect(m_cameraManager, &CameraManager::cameraReady, this, &MainWindow::onCameraReady);
     connect(m_cameraManager, &CameraManager::recorderError, this, &MainWindow::onRecorderError);
 
-    m_cameraManager->start();
+    m_motionDetector->setIdleTimeout(idleTimeout);
+    connect(m_motionDetector, &MotionDetector::idleChanged, this, &MainWindow::onIdleChanged);
+    connect(m_motionDetector, &MotionDetector::sceneChanged, this, &MainWindow::onSceneChanged);
+    modeTimer.start();
 }
 
 MainWindow::~MainWindow()
 {
+    delete m_frameRing;
     delete ui;
 }
 
+void MainWindow::startCamera(const QElapsedTimer &startupTimer)
+{
+    m_cameraManager->setStartupTimer(startupTimer);
+    m_cameraManager->start();
+}
+
+bool MainWindow::startReplay(const QString &filePath, bool realTime, bool quitWhenDone)
+{
+    m_replaySource = new ReplaySource(this);
+    if (!m_replaySource->open(filePath)) {
+        noCameraLabel->setText("Could not open replay file: " + m_replaySource->errorString());
+        m_viewStack->setCurrentWidget(noCameraLabel);
+        qWarning() << "failed to open replay" << filePath << m_replaySource->errorString();
+        return false;
+    }
+    m_replaySource->setRealTime(realTime);
+    quitAfterReplay = quitWhenDone;
+
+    // replayed frames are processed one by one as they arrive so a run over
+    // the same file always sees the same frames
+    connect(m_replaySource, &ReplaySource::frameAvailable, this, &MainWindow::onReplayFrame);
+    connect(m_replaySource, &ReplaySource::finished, this, &MainWindow::onReplayFinished);
+
+    m_viewStack->setCurrentWidget(videoView);
+    recordButton->setEnabled(false);
+    qDebug() << "replaying" << m_replaySource->frameCount() << "frames from" << filePath
+             << (realTime ? "at recorded pace" : "as fast as possible");
+
+    replayFrames = 0;
+    replayTimer.start();
+    m_replaySource->start();
+    return true;
+}
+
+bool MainWindow::startFrameDump(const QString &filePath)
+{
+    m_frameWriter = new RawFrameWriter(this);
+    if (!m_frameWriter->open(filePath)) {
+        qWarning() << "failed to open frame dump" << filePath << m_frameWriter->errorString();
+        return false;
+    }
+    FrameSource *source = m_replaySource ? static_cast<FrameSource *>(m_replaySource) : m_cameraManager;
+    connect(source, &FrameSource::frameAvailable, m_frameWriter, &RawFrameWriter::writeFrame);
+    qDebug() << "dumping raw frames to" << filePath;
+    return true;
+}
+
+bool MainWindow::startHttpServer(const QHostAddress &address, quint16 port)
+{
+    m_mjpegServer = new MjpegServer(this);
+    if (!m_mjpegServer->listen(address, port)) {
+        qWarning() << "failed to start http server on" << address.toString() << "port" << port
+                   << m_mjpegServer->errorString();
+        delete m_mjpegServer;
+        m_mjpegServer = nullptr;
+        return false;
+    }
+    qDebug() << "serving mjpeg on" << address.toString() << "port" << port << "(/stream and /status)";
+    return true;
+}
+
+void MainWindow::configureDetectorGrid(int blockSize, bool shiftedGrid, const QVector<int> &scales)
+{
+    m_motionDetector->setBlockSize(blockSize);
+    m_motionDetector->setShiftedGridEnabled(shiftedGrid);
+    m_motionDetector->setScales(scales);
+}
+
+void MainWindow::configureSceneChange(double activeFraction, bool gainCompensation)
+{
+    m_motionDetector->setSceneChangeFraction(activeFraction);
+    m_motionDetector->setGainCompensationEnabled(gainCompensation);
+}
+
+void MainWindow::startFrameRing(const QString &name)
+{
+    // the ring is sized from the first frame, so it is only created once one arrives
+    m_frameRingName = name;
+}
+
+void MainWindow::publishToFrameRing(const QImage &image, qint64 timestampUs, const QVector<QRect> &motionRectangles)
+{
+    // a bigger frame than the ring was made for means the camera changed, start a new ring.
+    // closing the old one marks it closed so attached readers know to open the name again
+    if (m_frameRing && quint64(image.sizeInBytes()) > m_frameRing->maxFrameBytes()) {
+        delete m_frameRing;
+        m_frameRing = nullptr;
+    }
+    if (!m_frameRing) {
+        m_frameRing = new framering::FrameRingWriter;
+        if (!m_frameRing->create(m_frameRingName.toStdString(), 8, image.sizeInBytes())) {
+            qWarning() << "failed to create frame ring" << m_frameRingName
+                       << QString::fromStdString(m_frameRing->errorString());
+            m_frameRingName.clear();
+            delete m_frameRing;
+            m_frameRing = nullptr;
+            return;
+        }
+        qDebug() << "publishing frames to shared memory ring" << m_frameRingName;
+    }
+
+    QVector<framering::Rect> rects;
+    rects.reserve(motionRectangles.size());
+    for (const QRect &rect : motionRectangles)
+        rects.append({ rect.x(), rect.y(), rect.width(), rect.height() });
+
+    if (!m_frameRing->publish(image.constBits(), image.width(), image.height(), image.bytesPerLine(),
+                              framering::PixelFormatXrgb32, timestampUs, rects.constData(), rects.size()))
+        qWarning() << "frame not published to ring:" << QString::fromStdString(m_frameRing->errorString());
+}
+
+void MainWindow::onReplayFrame(const QVideoFrame &frame)
+{
+    processFrame(frame);
+    replayFrames++;
+}
+
+void MainWindow::onReplayFinished()
+{
+    qint64 elapsed = replayTimer.elapsed();
+    qDebug() << "replay finished:" << replayFrames << "frames in" << elapsed << "ms"
+             << "(" << (elapsed > 0 ? replayFrames * 1000.0 / elapsed : 0.0) << "fps )";
+    if (m_frameWriter)
+        m_frameWriter->close();
+    if (quitAfterReplay)
+        qApp->quit();
+}
+
 void MainWindow::onCameraReady(bool ready)
 {
     if (ready) {
@@ -222,7 +401,7 @@ void MainWindow::captureImage()
     if (!lastProcessedImage.isNull()) {
         QString filePath = QFileDialog::getSaveFileName(this, "save image", "", "images (*.png *.jpg *.bmp)");
         if (!filePath.isEmpty())
-            lastProcessedImage.save(filePath);
+            annotatedImage().save(filePath);
     } else {
         m_cameraManager->captureImage();
     }
@@ -313,7 +492,7 @@ void MainWindow::onFrameAvailable(const QVideoFrame &frame)
 {
     currentFrame = frame;
     if (!processingFrame && !frameUpdateTimer->isActive()) {
-        frameUpdateTimer->start(33); // schedule or it wont work
+        frameUpdateTimer->start(frameInterval); // schedule or it wont work
         updatePending = true;
     } else {
         updatePending = true;
@@ -328,58 +507,91 @@ void MainWindow::processNextFrame()
     processingFrame = true;
     updatePending = false;
 
+    QElapsedTimer frameTimer;
+    frameTimer.start();
     processFrame(currentFrame);
+    modeBusyNs += frameTimer.nsecsElapsed();
+    modeFrames++;
 
     processingFrame = false;
 
     if (updatePending)
-        frameUpdateTimer->start(33);
+        frameUpdateTimer->start(frameInterval);
 }
 
 void MainWindow::processFrame(const QVideoFrame &frame)
 {
     if (!frame.isValid())
         return;
-    QImage image = frame.toImage();
-    if (image.isNull())
+    QImage processedImage = frame.toImage();
+    if (processedImage.isNull())
         return;
-    QImage processedImage = image.convertToFormat(QImage::Format_RGB32);
-
-    if (grayscaleValue > 0) {
-        float grayscaleFactor = grayscaleValue / 100.0f;
-        for (int y = 0; y < processedImage.height(); y++) {
-            QRgb *line = reinterpret_cast<QRgb*>(processedImage.scanLine(y));
-            for (int x = 0; x < processedImage.width(); x++) {
-                QRgb pixel = line[x];
-                int r = qRed(pixel), g = qGreen(pixel), b = qBlue(pixel);
-                int gray = qRound(0.299 * r + 0.587 * g + 0.114 * b);
-                r = qRound(r * (1 - grayscaleFactor) + gray * grayscaleFactor);
-                g = qRound(g * (1 - grayscaleFactor) + gray * grayscaleFactor);
-                b = qRound(b * (1 - grayscaleFactor) + gray * grayscaleFactor);
-                line[x] = qRgb(r, g, b);
-            }
-        }
+
+    // grayscale effect, luma for the detector and block differences in one pass
+    QVector<QRect> motionRectangles = m_motionDetector->blendAndDetect(processedImage, grayscaleValue);
+
+    if (!m_frameRingName.isEmpty())
+        publishToFrameRing(processedImage, frame.startTime(), motionRectangles);
+
+    // boxes, arrows and timestamp are drawn by annotatedImage() when a consumer
+    // needs them, a minimized window without viewers paints nothing
+    lastProcessedImage = processedImage;
+    lastMotionRectangles = motionRectangles;
+    lastRectangleMotion = m_motionDetector->rectangleMotion();
+    lastFrameTime = QDateTime::currentDateTime();
+    overlayPending = !motionRectangles.isEmpty() || showTimestamp;
+
+    if (m_mjpegServer)
+        m_mjpegServer->publishFrame(m_mjpegServer->streamClientCount() > 0 ? annotatedImage() : lastProcessedImage,
+                                    motionRectangles);
+    scheduleDisplay();
+
+    if (autoSaveEnabled && !motionRectangles.isEmpty() && !autoSaveTimer->isActive() && !autoSavePending) {
+        autoSavePending = true;
+        QTimer::singleShot(1000, this, &MainWindow::handleAutoSaveMotionImage);
     }
+}
 
-    QVector<QRect> motionRectangles = m_motionDetector->detect(processedImage);
+const QImage &MainWindow::annotatedImage()
+{
+    if (!overlayPending)
+        return lastProcessedImage;
+    overlayPending = false;
 
-    if (!motionRectangles.isEmpty()) {
-        QPainter painter(&processedImage);
+    if (!lastMotionRectangles.isEmpty()) {
+        QPainter painter(&lastProcessedImage);
         painter.setPen(QPen(Qt::red, 3));
-        for (const QRect &rect : motionRectangles)
+        for (const QRect &rect : std::as_const(lastMotionRectangles))
             painter.drawRect(rect);
+
+        // direction of travel, exaggerated so a few pixels per frame are visible
+        const QVector<QPointF> &motion = lastRectangleMotion;
+        const QVector<QRect> &motionRectangles = lastMotionRectangles;
+        painter.setPen(QPen(Qt::yellow, 3));
+        for (int i = 0; i < motion.size() && i < motionRectangles.size(); i++) {
+            if (motion[i].isNull())
+                continue;
+            QLineF arrow(motionRectangles[i].center(), motionRectangles[i].center() + motion[i] * 5);
+            painter.drawLine(arrow);
+            QLineF head(arrow.p2(), arrow.p1());
+            head.setLength(12);
+            head.setAngle(head.angle() + 25);
+            painter.drawLine(head);
+            head.setAngle(head.angle() - 50);
+            painter.drawLine(head);
+        }
         painter.end();
     }
 
     if (showTimestamp) {
-        QPainter painter(&processedImage);
-        QString timestampText = QDateTime::currentDateTime().toString("yyyy-MM-dd hh:mm:ss");
+        QPainter painter(&lastProcessedImage);
+        QString timestampText = lastFrameTime.toString("yyyy-MM-dd hh:mm:ss");
         QFont font = painter.font();
         font.setPointSize(20);
         font.setBold(true);
         painter.setFont(font);
         int margin = 30;
-        QRect textRect(margin, margin, processedImage.width() - (margin * 2), 30);
+        QRect textRect(margin, margin, lastProcessedImage.width() - (margin * 2), 30);
         painter.setPen(Qt::black);
         for (int dx = -1; dx <= 1; dx++) {
             for (int dy = -1; dy <= 1; dy++) {
@@ -392,22 +604,56 @@ void MainWindow::processFrame(const QVideoFrame &frame)
         painter.drawText(textRect, Qt::AlignRight, timestampText);
         painter.end();
     }
+    return lastProcessedImage;
+}
 
-    lastProcessedImage = processedImage;
-    videoItem->setPixmap(QPixmap::fromImage(processedImage));
+void MainWindow::setDisplayRate(int fps)
+{
+    displayInterval = 1000 / qBound(1, fps, 120);
+}
+
+bool MainWindow::isVideoVisible() const
+{
+    if (isMinimized() || !isVisible() || m_viewStack->currentWidget() != videoView)
+        return false;
+    // covered or on a hidden virtual desktop, where the platform reports it
+    QWindow *window = windowHandle();
+    return !window || window->isExposed();
+}
+
+void MainWindow::scheduleDisplay()
+{
+    displayPending = true;
+    if (!displayTimer->isActive())
+        displayTimer->start(displayInterval);
+}
+
+void MainWindow::updateDisplay()
+{
+    // nothing is converted while nobody can see it, showing the window again
+    // presents the latest frame
+    if (!displayPending || lastProcessedImage.isNull() || !isVideoVisible())
+        return;
+    displayPending = false;
+
+    // scale down to what the view actually shows before the pixmap upload,
+    // the item is scaled back up so scene coordinates stay in frame pixels
+    const QSize target = videoView->viewport()->size() * videoView->devicePixelRatioF();
+    QImage displayImage = annotatedImage();
+    // nearest neighbour is enough for a preview already at viewport resolution
+    // and keeps the downscale cheap on every repaint
+    if (!target.isEmpty() && (displayImage.width() > target.width() || displayImage.height() > target.height()))
+        displayImage = displayImage.scaled(target, Qt::KeepAspectRatio, Qt::FastTransformation);
+    videoItem->setPixmap(QPixmap::fromImage(displayImage));
+    videoItem->setScale(lastProcessedImage.width() / qreal(displayImage.width()));
 
     QRectF currentRect = videoScene->sceneRect();
-    QRectF itemRect = videoItem->boundingRect();
+    QRectF itemRect = videoItem->sceneBoundingRect();
     if (qAbs(currentRect.width() - itemRect.width()) > 5 ||
         qAbs(currentRect.height() - itemRect.height()) > 5) {
         videoScene->setSceneRect(itemRect);
         videoView->fitInView(videoScene->sceneRect(), Qt::KeepAspectRatio);
     }
-
-    if (autoSaveEnabled && !motionRectangles.isEmpty() && !autoSaveTimer->isActive() && !autoSavePending) {
-        autoSavePending = true;
-        QTimer::singleShot(1000, this, &MainWindow::handleAutoSaveMotionImage);
-    }
 }
 
 void MainWindow::toggleAutoSaveMotionImages(Qt::CheckState state)
@@ -421,7 +667,7 @@ void MainWindow::handleAutoSaveMotionImage()
     QString picturesDir = QStandardPaths::writableLocation(QStandardPaths::PicturesLocation);
     QString timestamp = QDateTime::currentDateTime().toString("yyyyMMdd_hhmmss");
     QString fileName = picturesDir + "/motion_" + timestamp + ".png";
-    if (lastProcessedImage.save(fileName))
+    if (annotatedImage().save(fileName))
         qDebug() << "motion image auto-saved to:" << fileName;
     else
         qDebug() << "failed to auto-save motion image.";
@@ -446,9 +692,67 @@ void MainWindow::validateAndSetAutoSaveInterval()
     }
 }
 
+void MainWindow::toggleMotionDirection(Qt::CheckState state)
+{
+    m_motionDetector->setMotionEstimationEnabled(state == Qt::Checked);
+}
+
+void MainWindow::toggleLowPowerIdle(Qt::CheckState state)
+{
+    m_motionDetector->setLowPowerEnabled(state == Qt::Checked);
+}
+
+void MainWindow::validateAndSetIdleTimeout()
+{
+    bool ok;
+    int value = idleTimeoutEdit->text().toInt(&ok);
+
+    if (ok && value >= 5 && value <= 3600) {
+        idleTimeout = value * 1000;
+        m_motionDetector->setIdleTimeout(idleTimeout);
+        qDebug() << "Idle timeout updated to" << value << "seconds.";
+    } else {
+        qWarning() << "Invalid idle timeout entered. Reverting to previous value.";
+        idleTimeoutEdit->setText(QString::number(idleTimeout / 1000));
+    }
+}
+
+void MainWindow::onIdleChanged(bool idle)
+{
+    // report what the mode we are leaving cost so idle savings can be measured
+    qint64 wallMs = modeTimer.restart();
+    double busyMs = modeBusyNs / 1e6;
+    qDebug() << (idle ? "entering" : "leaving") << "idle mode, previous mode processed" << modeFrames
+             << "frames using" << (wallMs > 0 ? busyMs * 1000.0 / wallMs : 0.0) << "ms of cpu per second";
+    modeBusyNs = 0;
+    modeFrames = 0;
+
+    frameInterval = idle ? 333 : 33;
+    if (!idle && frameUpdateTimer->isActive())
+        frameUpdateTimer->start(frameInterval);
+}
+
+void MainWindow::onSceneChanged(double activeFraction, double meanLumaShift)
+{
+    qDebug() << "scene change:" << qRound(activeFraction * 100) << "% of blocks changed, mean luma shift"
+             << meanLumaShift << "- not treated as motion";
+    if (m_mjpegServer)
+        m_mjpegServer->reportSceneChange();
+}
+
 void MainWindow::resizeEvent(QResizeEvent *event)
 {
     QMainWindow::resizeEvent(event);
     if (videoView && !videoScene->sceneRect().isEmpty())
         videoView->fitInView(videoScene->sceneRect(), Qt::KeepAspectRatio);
+    // the shown pixmap was scaled for the old size
+    if (!lastProcessedImage.isNull())
+        scheduleDisplay();
+}
+
+void MainWindow::changeEvent(QEvent *event)
+{
+    QMainWindow::changeEvent(event);
+    if (event->type() == QEvent::WindowStateChange && !isMinimized() && !lastProcessedImage.isNull())
+        scheduleDisplay();
 }
@@ -5,6 +5,9 @@
 #include "cameramanager.h"
 #include <QMainWindow>
 #include <QVideoFrame>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QDateTime>
 
 class QPushButton;
 class QLabel;
@@ -17,6 +20,10 @@ class QGraphicsPixmapItem;
 class QTimer;
 class QResizeEvent;
 class QStackedWidget;
+class ReplaySource;
+class RawFrameWriter;
+class MjpegServer;
+namespace framering { class FrameRingWriter; }
 
 namespace Ui {
 class MainWindow;
@@ -29,8 +36,18 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    void startCamera(const QElapsedTimer &startupTimer);
+    bool startReplay(const QString &filePath, bool realTime, bool quitWhenDone);
+    bool startFrameDump(const QString &filePath);
+    bool startHttpServer(const QHostAddress &address, quint16 port);
+    void startFrameRing(const QString &name);
+    void setDisplayRate(int fps);
+    void configureDetectorGrid(int blockSize, bool shiftedGrid, const QVector<int> &scales);
+    void configureSceneChange(double activeFraction, bool gainCompensation);
+
 protected:
     void resizeEvent(QResizeEvent *event) override;
+    void changeEvent(QEvent *event) override;
 
 private slots:
     void captureImage();
@@ -39,6 +56,7 @@ private slots:
     void toggleTimestamp(Qt::CheckState state);
     void onImageCaptured(int id, const QImage &image);
     void processNextFrame();
+    void updateDisplay();
     void toggleMotionDetection(Qt::CheckState state);
     void setMotionThreshold(int value);
     void setMotionSensitivity(int value);
@@ -49,13 +67,29 @@ private slots:
     void toggleAutoSaveMotionImages(Qt::CheckState state);
     void handleAutoSaveMotionImage();
     void validateAndSetAutoSaveInterval();
+    void toggleMotionDirection(Qt::CheckState state);
+    void toggleLowPowerIdle(Qt::CheckState state);
+    void validateAndSetIdleTimeout();
+    void onIdleChanged(bool idle);
+    void onSceneChanged(double activeFraction, double meanLumaShift);
+    void onReplayFrame(const QVideoFrame &frame);
+    void onReplayFinished();
 
 private:
     void processFrame(const QVideoFrame &frame);
+    bool isVideoVisible() const;
+    void scheduleDisplay();
+    const QImage &annotatedImage();
+    void publishToFrameRing(const QImage &image, qint64 timestampUs, const QVector<QRect> &motionRectangles);
 
     Ui::MainWindow *ui;
     MotionDetector *m_motionDetector;
     CameraManager *m_cameraManager;
+    ReplaySource *m_replaySource;
+    RawFrameWriter *m_frameWriter;
+    MjpegServer *m_mjpegServer;
+    framering::FrameRingWriter *m_frameRing;
+    QString m_frameRingName;
     QStackedWidget *m_viewStack;
 
     QGraphicsView *videoView;
@@ -71,19 +105,28 @@ private:
     QCheckBox *timestampCheckbox;
     QCheckBox *motionDetectionCheckbox;
     QCheckBox *autoSaveImageCheckbox;
+    QCheckBox *lowPowerCheckbox;
+    QCheckBox *motionDirectionCheckbox;
     QSlider *thresholdSlider;
     QSlider *sensitivitySlider;
     QLineEdit *autoSaveIntervalEdit;
     QLabel *autoSaveIntervalLabel;
     QLabel *currentIntervalLabel;
+    QLineEdit *idleTimeoutEdit;
 
     QTimer *frameUpdateTimer;
+    QTimer *displayTimer;
     QTimer *recordingTimer;
     QTimer *autoSaveTimer;
 
     int grayscaleValue;
     bool showTimestamp;
     QImage lastProcessedImage;
+    // the overlay is only painted once something actually uses the frame
+    QVector<QRect> lastMotionRectangles;
+    QVector<QPointF> lastRectangleMotion;
+    QDateTime lastFrameTime;
+    bool overlayPending;
     QVideoFrame currentFrame;
     bool processingFrame;
     bool updatePending;
@@ -93,6 +136,17 @@ private:
     bool autoSavePending;
     int autoSaveInterval;
 
+    int frameInterval;
+    int displayInterval;
+    bool displayPending;
+    int idleTimeout;
+    QElapsedTimer modeTimer;
+    qint64 modeBusyNs;
+    int modeFrames;
+
+    QElapsedTimer replayTimer;
+    int replayFrames;
+    bool quitAfterReplay;
 };
 
 #endif // MAINWINDOW_H
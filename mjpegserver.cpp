@@ -0,0 +1,222 @@
+#include "mjpegserver.h"
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QBuffer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+static const int JpegQuality = 75;
+static const qint64 MaxClientBacklog = 2 * 1024 * 1024; // drop frames for clients further behind than this
+static const int RequestTimeoutMs = 5000; // clients must send a complete request header within this
+static const QByteArray Boundary = "mjpegframe";
+
+MjpegServer::MjpegServer(QObject *parent)
+    : QObject(parent),
+    m_encoding(false),
+    m_frameNumber(0)
+{
+    m_server = new QTcpServer(this);
+    connect(m_server, &QTcpServer::newConnection, this, &MjpegServer::onNewConnection);
+
+    // jpeg encoding happens on its own thread, the context object only exists
+    // so queued functors run there
+    m_encoderThread = new QThread(this);
+    m_encoder = new QObject;
+    m_encoder->moveToThread(m_encoderThread);
+    connect(m_encoderThread, &QThread::finished, m_encoder, &QObject::deleteLater);
+    m_encoderThread->start();
+}
+
+MjpegServer::~MjpegServer()
+{
+    m_encoderThread->quit();
+    m_encoderThread->wait();
+}
+
+bool MjpegServer::listen(const QHostAddress &address, quint16 port)
+{
+    return m_server->listen(address, port);
+}
+
+QString MjpegServer::errorString() const
+{
+    return m_server->errorString();
+}
+
+int MjpegServer::streamClientCount() const
+{
+    return m_streamClients.size();
+}
+
+void MjpegServer::publishFrame(const QImage &image, const QVector<QRect> &motionRectangles)
+{
+    m_frameNumber++;
+    m_motionRectangles = motionRectangles;
+    if (!motionRectangles.isEmpty())
+        m_lastMotionTime = QDateTime::currentDateTime();
+
+    if (m_streamClients.isEmpty())
+        return;
+
+    // never queue more than one frame behind the encoder, newer frames replace older ones
+    if (m_encoding) {
+        m_pendingImage = image;
+        return;
+    }
+    encodeFrame(image);
+}
+
+void MjpegServer::reportSceneChange()
+{
+    m_lastSceneChangeTime = QDateTime::currentDateTime();
+}
+
+void MjpegServer::encodeFrame(const QImage &image)
+{
+    m_encoding = true;
+    QMetaObject::invokeMethod(m_encoder, [this, image]() {
+        QByteArray jpeg;
+        QBuffer buffer(&jpeg);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, "JPG", JpegQuality);
+        QMetaObject::invokeMethod(this, [this, jpeg]() { onFrameEncoded(jpeg); }, Qt::QueuedConnection);
+    }, Qt::QueuedConnection);
+}
+
+void MjpegServer::onFrameEncoded(const QByteArray &jpeg)
+{
+    m_encoding = false;
+
+    if (!jpeg.isEmpty()) {
+        QByteArray part;
+        part.reserve(jpeg.size() + 128);
+        part += "--" + Boundary + "\r\n";
+        part += "Content-Type: image/jpeg\r\n";
+        part += "Content-Length: " + QByteArray::number(jpeg.size()) + "\r\n\r\n";
+        part += jpeg;
+        part += "\r\n";
+        m_lastPart = part;
+
+        // every client gets the same implicitly shared buffer
+        for (QTcpSocket *client : std::as_const(m_streamClients)) {
+            if (client->bytesToWrite() > MaxClientBacklog)
+                continue;
+            client->write(m_lastPart);
+        }
+    }
+
+    if (!m_pendingImage.isNull() && !m_streamClients.isEmpty()) {
+        QImage next = m_pendingImage;
+        m_pendingImage = QImage();
+        encodeFrame(next);
+    }
+}
+
+void MjpegServer::onNewConnection()
+{
+    while (QTcpSocket *socket = m_server->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead, this, &MjpegServer::onReadyRead);
+        connect(socket, &QTcpSocket::disconnected, this, &MjpegServer::onDisconnected);
+        m_pendingRequests.insert(socket, QByteArray());
+        // drop connections that never finish their request so they cannot pile up
+        QTimer::singleShot(RequestTimeoutMs, socket, [this, socket]() {
+            if (m_pendingRequests.remove(socket))
+                socket->disconnectFromHost();
+        });
+    }
+}
+
+void MjpegServer::onReadyRead()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket || !m_pendingRequests.contains(socket)) {
+        // streaming clients have nothing more to say
+        if (socket)
+            socket->readAll();
+        return;
+    }
+
+    QByteArray &request = m_pendingRequests[socket];
+    request += socket->readAll();
+    if (request.contains("\r\n\r\n")) {
+        QByteArray complete = request;
+        m_pendingRequests.remove(socket);
+        handleRequest(socket, complete);
+    } else if (request.size() > 8192) {
+        m_pendingRequests.remove(socket);
+        socket->disconnectFromHost();
+    }
+}
+
+void MjpegServer::onDisconnected()
+{
+    QTcpSocket *socket = qobject_cast<QTcpSocket *>(sender());
+    if (!socket)
+        return;
+    m_pendingRequests.remove(socket);
+    m_streamClients.removeAll(socket);
+    socket->deleteLater();
+}
+
+void MjpegServer::handleRequest(QTcpSocket *socket, const QByteArray &request)
+{
+    QList<QByteArray> requestLine = request.left(request.indexOf("\r\n")).split(' ');
+    QByteArray method = requestLine.value(0);
+    QByteArray path = requestLine.value(1);
+    int query = path.indexOf('?');
+    if (query >= 0)
+        path.truncate(query);
+
+    if (method != "GET") {
+        socket->write("HTTP/1.0 405 Method Not Allowed\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+    } else if (path == "/" || path == "/stream") {
+        socket->write("HTTP/1.0 200 OK\r\n"
+                      "Content-Type: multipart/x-mixed-replace; boundary=" + Boundary + "\r\n"
+                      "Cache-Control: no-cache\r\n"
+                      "Connection: close\r\n\r\n");
+        if (!m_lastPart.isEmpty())
+            socket->write(m_lastPart);
+        m_streamClients.append(socket);
+        qDebug() << "mjpeg client connected from" << socket->peerAddress().toString()
+                 << "," << m_streamClients.size() << "viewers";
+    } else if (path == "/status") {
+        QByteArray body = statusJson();
+        socket->write("HTTP/1.0 200 OK\r\n"
+                      "Content-Type: application/json\r\n"
+                      "Cache-Control: no-cache\r\n"
+                      "Content-Length: " + QByteArray::number(body.size()) + "\r\n"
+                      "Connection: close\r\n\r\n");
+        socket->write(body);
+        socket->disconnectFromHost();
+    } else {
+        socket->write("HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n");
+        socket->disconnectFromHost();
+    }
+}
+
+QByteArray MjpegServer::statusJson() const
+{
+    QJsonArray rectangles;
+    for (const QRect &rect : m_motionRectangles) {
+        QJsonObject r;
+        r["x"] = rect.x();
+        r["y"] = rect.y();
+        r["width"] = rect.width();
+        r["height"] = rect.height();
+        rectangles.append(r);
+    }
+
+    QJsonObject status;
+    status["motion"] = !m_motionRectangles.isEmpty();
+    status["rectangles"] = rectangles;
+    status["frame"] = qint64(m_frameNumber);
+    status["lastMotion"] = m_lastMotionTime.isValid() ? m_lastMotionTime.toString(Qt::ISODate) : QString();
+    status["lastSceneChange"] = m_lastSceneChangeTime.isValid() ? m_lastSceneChangeTime.toString(Qt::ISODate) : QString();
+    status["viewers"] = m_streamClients.size();
+    return QJsonDocument(status).toJson(QJsonDocument::Compact);
+}
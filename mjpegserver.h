@@ -0,0 +1,60 @@
+#ifndef MJPEGSERVER_H
+#define MJPEGSERVER_H
+
+#include <QObject>
+#include <QImage>
+#include <QVector>
+#include <QRect>
+#include <QHash>
+#include <QByteArray>
+#include <QDateTime>
+#include <QHostAddress>
+
+class QTcpServer;
+class QTcpSocket;
+class QThread;
+
+// serves the processed feed as multipart MJPEG on /stream and the current
+// motion state as JSON on /status
+class MjpegServer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit MjpegServer(QObject *parent = nullptr);
+    ~MjpegServer();
+
+    bool listen(const QHostAddress &address, quint16 port);
+    QString errorString() const;
+    int streamClientCount() const;
+
+    void publishFrame(const QImage &image, const QVector<QRect> &motionRectangles);
+    void reportSceneChange();
+
+private slots:
+    void onNewConnection();
+    void onReadyRead();
+    void onDisconnected();
+
+private:
+    void encodeFrame(const QImage &image);
+    void onFrameEncoded(const QByteArray &jpeg);
+    void handleRequest(QTcpSocket *socket, const QByteArray &request);
+    QByteArray statusJson() const;
+
+    QTcpServer *m_server;
+    QThread *m_encoderThread;
+    QObject *m_encoder;
+    QHash<QTcpSocket *, QByteArray> m_pendingRequests;
+    QVector<QTcpSocket *> m_streamClients;
+
+    bool m_encoding;
+    QImage m_pendingImage;
+    QByteArray m_lastPart;
+
+    QVector<QRect> m_motionRectangles;
+    QDateTime m_lastMotionTime;
+    QDateTime m_lastSceneChangeTime;
+    quint64 m_frameNumber;
+};
+
+#endif // MJPEGSERVER_H
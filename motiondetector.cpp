@@ -1,12 +1,211 @@
 #include "motiondetector.h"
 #include <QDebug>
+#include <climits>
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const int CellSize = 4; // difference sums are kept per 4x4 cell, block sizes are multiples of it
+static const int IdleSampleStep = CellSize; // idle mode looks at one pixel per cell
+static const int BlockSize = 16; // block matching always compares 16x16 blocks
+static const int SearchRange = 16; // largest displacement the block search looks for, in pixels
+static const int MaxSearchSteps = 8; // large diamond moves before giving up
+static const int MaxSearchedBlocks = 256; // per frame, more active blocks are subsampled
+
+static inline int luma(QRgb pixel)
+{
+    // 0.299 r + 0.587 g + 0.114 b in 8 bit fixed point
+    return (qRed(pixel) * 77 + qGreen(pixel) * 150 + qBlue(pixel) * 29 + 128) >> 8;
+}
+
+// a single walk over the frame doing everything the pipeline needs per pixel:
+// blend towards gray by blend/256 in place, store the luma as the next
+// reference, and add |luma - previous luma| to the sum of the pixel's cell.
+// the difference pass also totals the luma and the signed luma change so a
+// global brightness shift can be told apart from motion.
+// instantiated per combination so the inner loop carries no dead work
+template <bool Blend, bool WriteLuma, bool Difference>
+static void fusedLumaPass(QImage &image, int blend, QImage *currentLuma,
+                          const QImage *previousLuma, quint32 *cellSums,
+                          qint64 *lumaTotal = nullptr, qint64 *shiftTotal = nullptr)
+{
+    const int width = image.width();
+    const int height = image.height();
+    const int cellsX = (width + CellSize - 1) / CellSize;
+    const qsizetype bytesPerLine = image.bytesPerLine();
+    uchar *bits = Blend ? image.bits() : nullptr;
+    const uchar *constBits = Blend ? bits : image.constBits();
+    uchar *lumaBits = WriteLuma ? currentLuma->bits() : nullptr;
+    const qsizetype lumaBytesPerLine = WriteLuma ? currentLuma->bytesPerLine() : 0;
+    const uchar *previousBits = Difference ? previousLuma->constBits() : nullptr;
+    const qsizetype previousBytesPerLine = Difference ? previousLuma->bytesPerLine() : 0;
+    const int keep = 256 - blend;
+    qint64 frameLuma = 0, frameShift = 0;
+
+    for (int y = 0; y < height; y++) {
+        const QRgb *source = reinterpret_cast<const QRgb *>(constBits + y * bytesPerLine);
+        QRgb *target = Blend ? reinterpret_cast<QRgb *>(bits + y * bytesPerLine) : nullptr;
+        uchar *lumaLine = WriteLuma ? lumaBits + y * lumaBytesPerLine : nullptr;
+        const uchar *previousLine = Difference ? previousBits + y * previousBytesPerLine : nullptr;
+        quint32 *rowSums = Difference ? cellSums + (y / CellSize) * cellsX : nullptr;
+
+        int rowLuma = 0, rowShift = 0;
+        for (int x = 0, cell = 0; x < width; cell++) {
+            const int end = qMin(x + CellSize, width);
+            quint32 sum = 0;
+            for (; x < end; x++) {
+                const QRgb pixel = source[x];
+                const int gray = luma(pixel);
+                if (Blend) {
+                    const int r = (qRed(pixel) * keep + gray * blend + 128) >> 8;
+                    const int g = (qGreen(pixel) * keep + gray * blend + 128) >> 8;
+                    const int b = (qBlue(pixel) * keep + gray * blend + 128) >> 8;
+                    target[x] = qRgb(r, g, b);
+                }
+                if (WriteLuma)
+                    lumaLine[x] = uchar(gray);
+                if (Difference) {
+                    const int change = gray - previousLine[x];
+                    sum += qAbs(change);
+                    rowLuma += gray;
+                    rowShift += change;
+                }
+            }
+            if (Difference)
+                rowSums[cell] += sum;
+        }
+        frameLuma += rowLuma;
+        frameShift += rowShift;
+    }
+    if (Difference) {
+        *lumaTotal = frameLuma;
+        *shiftTotal = frameShift;
+    }
+}
+
+// cell sums of |current - gain * previous|, used to look past an exposure change
+static void compensatedDifference(const QImage &current, const QImage &previous, double gain, quint32 *cellSums)
+{
+    uchar scaled[256];
+    for (int i = 0; i < 256; i++)
+        scaled[i] = uchar(qBound(0, qRound(i * gain), 255));
+
+    const int width = current.width();
+    const int height = current.height();
+    const int cellsX = (width + CellSize - 1) / CellSize;
+    for (int y = 0; y < height; y++) {
+        const uchar *currentLine = current.constScanLine(y);
+        const uchar *previousLine = previous.constScanLine(y);
+        quint32 *rowSums = cellSums + (y / CellSize) * cellsX;
+        for (int x = 0, cell = 0; x < width; cell++) {
+            const int end = qMin(x + CellSize, width);
+            quint32 sum = 0;
+            for (; x < end; x++)
+                sum += qAbs(currentLine[x] - scaled[previousLine[x]]);
+            rowSums[cell] += sum;
+        }
+    }
+}
+
+static bool isXrgb32(QImage::Format format)
+{
+    return format == QImage::Format_RGB32 ||
+           format == QImage::Format_ARGB32 ||
+           format == QImage::Format_ARGB32_Premultiplied;
+}
+
+// sum of absolute differences of two 16x16 luma blocks
+static inline quint32 blockSad(const uchar *a, qsizetype strideA, const uchar *b, qsizetype strideB)
+{
+#ifdef __SSE2__
+    __m128i sum = _mm_setzero_si128();
+    for (int row = 0; row < BlockSize; row++) {
+        const __m128i rowA = _mm_loadu_si128(reinterpret_cast<const __m128i *>(a + row * strideA));
+        const __m128i rowB = _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + row * strideB));
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(rowA, rowB));
+    }
+    return quint32(_mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8)));
+#else
+    quint32 sum = 0;
+    for (int row = 0; row < BlockSize; row++) {
+        for (int x = 0; x < BlockSize; x++)
+            sum += qAbs(a[row * strideA + x] - b[row * strideB + x]);
+    }
+    return sum;
+#endif
+}
+
+// diamond search for where the block at (x, y) of the current frame came from
+// in the previous one, returns how far its content moved
+static QPoint diamondSearch(const QImage &current, const QImage &previous, int x, int y)
+{
+    static const QPoint largeDiamond[] = { QPoint(0, -2), QPoint(1, -1), QPoint(2, 0), QPoint(1, 1),
+                                          QPoint(0, 2), QPoint(-1, 1), QPoint(-2, 0), QPoint(-1, -1) };
+    static const QPoint smallDiamond[] = { QPoint(0, -1), QPoint(1, 0), QPoint(0, 1), QPoint(-1, 0) };
+
+    const qsizetype stride = current.bytesPerLine();
+    const qsizetype previousStride = previous.bytesPerLine();
+    const uchar *block = current.constBits() + y * stride + x;
+    const int maxX = current.width() - BlockSize;
+    const int maxY = current.height() - BlockSize;
+
+    auto cost = [&](const QPoint &offset) -> quint32 {
+        const int px = x + offset.x(), py = y + offset.y();
+        if (qAbs(offset.x()) > SearchRange || qAbs(offset.y()) > SearchRange ||
+            px < 0 || py < 0 || px > maxX || py > maxY)
+            return UINT_MAX;
+        return blockSad(block, stride, previous.constBits() + py * previousStride + px, previousStride);
+    };
+
+    QPoint center(0, 0);
+    quint32 best = cost(center);
+    for (int step = 0; step < MaxSearchSteps; step++) {
+        QPoint bestOffset = center;
+        for (const QPoint &delta : largeDiamond) {
+            const quint32 c = cost(center + delta);
+            if (c < best) {
+                best = c;
+                bestOffset = center + delta;
+            }
+        }
+        if (bestOffset == center)
+            break;
+        center = bestOffset;
+    }
+    QPoint refined = center;
+    for (const QPoint &delta : smallDiamond) {
+        const quint32 c = cost(center + delta);
+        if (c < best) {
+            best = c;
+            refined = center + delta;
+        }
+    }
+    // the match sits at +offset in the previous frame, so the content moved by -offset
+    return -refined;
+}
 
 MotionDetector::MotionDetector(QObject *parent)
     : QObject(parent),
     m_enabled(true),
     m_threshold(20),
-    m_sensitivity(50)
+    m_sensitivity(50),
+    m_blockSize(16),
+    m_shiftedGrid(false),
+    m_scales({ 1 }),
+    m_unitSize(16),
+    m_cellsX(0),
+    m_cellsY(0),
+    m_sceneChangeFraction(0.6),
+    m_gainCompensationEnabled(false),
+    m_lowPowerEnabled(false),
+    m_idle(false),
+    m_idleTimeout(60000),
+    m_motionEstimationEnabled(false),
+    m_motionFieldColumns(0)
 {
+    m_lastMotionTimer.start();
 }
 
 void MotionDetector::setEnabled(bool enabled)
@@ -27,91 +226,412 @@ void MotionDetector::setSensitivity(int sensitivity)
     m_sensitivity = sensitivity;
 }
 
+void MotionDetector::setBlockSize(int blockSize)
+{
+    // half blocks have to land on cell boundaries
+    m_blockSize = qBound(8, (blockSize + 4) / 8 * 8, 128);
+    if (m_blockSize != blockSize)
+        qWarning() << "block size" << blockSize << "rounded to" << m_blockSize;
+}
+
+void MotionDetector::setShiftedGridEnabled(bool enabled)
+{
+    m_shiftedGrid = enabled;
+}
+
+void MotionDetector::setScales(const QVector<int> &scales)
+{
+    m_scales.clear();
+    for (int scale : scales) {
+        if (scale < 1 || scale > 8)
+            qWarning() << "ignoring scale" << scale << ", scales go from 1 to 8";
+        else if (!m_scales.contains(scale))
+            m_scales.append(scale);
+    }
+    if (m_scales.isEmpty())
+        m_scales.append(1);
+}
+
+void MotionDetector::setSceneChangeFraction(double fraction)
+{
+    m_sceneChangeFraction = fraction;
+}
+
+void MotionDetector::setGainCompensationEnabled(bool enabled)
+{
+    m_gainCompensationEnabled = enabled;
+}
+
+bool MotionDetector::isGlobalChange(int activeUnits) const
+{
+    return m_sceneChangeFraction > 0 && !m_activeUnits.isEmpty() &&
+           activeUnits > m_sceneChangeFraction * m_activeUnits.size();
+}
+
+void MotionDetector::setLowPowerEnabled(bool enabled)
+{
+    m_lowPowerEnabled = enabled;
+    m_lastMotionTimer.restart();
+    if (!m_lowPowerEnabled)
+        setIdle(false);
+}
+
+void MotionDetector::setIdleTimeout(int msecs)
+{
+    m_idleTimeout = msecs;
+}
+
+bool MotionDetector::isIdle() const
+{
+    return m_idle;
+}
+
+void MotionDetector::setIdle(bool idle)
+{
+    if (m_idle == idle)
+        return;
+    m_idle = idle;
+    emit idleChanged(m_idle);
+}
+
+void MotionDetector::setMotionEstimationEnabled(bool enabled)
+{
+    m_motionEstimationEnabled = enabled;
+}
+
+const QVector<QPoint> &MotionDetector::motionVectorField() const
+{
+    return m_motionField;
+}
+
+const QVector<bool> &MotionDetector::motionVectorValid() const
+{
+    return m_motionValid;
+}
+
+int MotionDetector::motionFieldColumns() const
+{
+    return m_motionFieldColumns;
+}
+
+const QVector<QPointF> &MotionDetector::rectangleMotion() const
+{
+    return m_rectangleMotion;
+}
+
+void MotionDetector::estimateMotion(const QVector<QPoint> &motionUnits, const QImage &current, const QImage &previous)
+{
+    const int unitsX = (current.width() + m_unitSize - 1) / m_unitSize;
+    const int unitsY = (current.height() + m_unitSize - 1) / m_unitSize;
+    m_motionFieldColumns = unitsX;
+    m_motionField.fill(QPoint(0, 0), unitsX * unitsY);
+    m_motionValid.fill(false, unitsX * unitsY);
+    if (current.width() < BlockSize || current.height() < BlockSize)
+        return;
+
+    // with lots of activity only every n-th block is searched so the cost stays bounded
+    const int stride = (motionUnits.size() + MaxSearchedBlocks - 1) / MaxSearchedBlocks;
+    for (int i = 0; i < motionUnits.size(); i += stride) {
+        const QPoint &p = motionUnits[i];
+        // a 16x16 block centred on the unit, pulled inside the frame along the edges
+        const int x = qBound(0, p.x() * m_unitSize + (m_unitSize - BlockSize) / 2, current.width() - BlockSize);
+        const int y = qBound(0, p.y() * m_unitSize + (m_unitSize - BlockSize) / 2, current.height() - BlockSize);
+        const int index = p.y() * unitsX + p.x();
+        m_motionField[index] = diamondSearch(current, previous, x, y);
+        m_motionValid[index] = true;
+    }
+}
+
+void MotionDetector::buildIntegral()
+{
+    // summed area table over the cells, one extra zero row and column in front.
+    // unsigned wrap around is fine, any block's sum fits in 32 bits
+    const int stride = m_cellsX + 1;
+    m_integral.resize(stride * (m_cellsY + 1));
+    std::fill(m_integral.begin(), m_integral.begin() + stride, 0);
+    for (int cy = 0; cy < m_cellsY; cy++) {
+        const quint32 *cells = m_cellSums.constData() + cy * m_cellsX;
+        const quint32 *above = m_integral.constData() + cy * stride;
+        quint32 *row = m_integral.data() + (cy + 1) * stride;
+        quint32 running = 0;
+        row[0] = 0;
+        for (int cx = 0; cx < m_cellsX; cx++) {
+            running += cells[cx];
+            row[cx + 1] = above[cx + 1] + running;
+        }
+    }
+}
+
+quint32 MotionDetector::cellRectSum(int cx0, int cy0, int cx1, int cy1) const
+{
+    const int stride = m_cellsX + 1;
+    return m_integral[cy1 * stride + cx1] - m_integral[cy0 * stride + cx1]
+           - m_integral[cy1 * stride + cx0] + m_integral[cy0 * stride + cx0];
+}
+
+QVector<QPoint> MotionDetector::findMotionUnits(int width, int height)
+{
+    // blocks of every scale, optionally also on a grid shifted by half a block,
+    // each costs four table lookups no matter how big it is. active blocks are
+    // marked on a grid of units small enough to represent all of them
+    m_unitSize = m_shiftedGrid ? m_blockSize / 2 : m_blockSize;
+    const int unitsX = (width + m_unitSize - 1) / m_unitSize;
+    const int unitsY = (height + m_unitSize - 1) / m_unitSize;
+    m_activeUnits.fill(0, unitsX * unitsY);
+
+    for (int scale : std::as_const(m_scales)) {
+        const int size = m_blockSize * scale;
+        const int step = m_shiftedGrid ? size / 2 : size;
+        for (int y0 = 0; y0 < height; y0 += step) {
+            const int y1 = qMin(y0 + size, height);
+            for (int x0 = 0; x0 < width; x0 += step) {
+                const int x1 = qMin(x0 + size, width);
+                const quint32 sum = cellRectSum(x0 / CellSize, y0 / CellSize,
+                                                (x1 + CellSize - 1) / CellSize, (y1 + CellSize - 1) / CellSize);
+                if (sum <= quint32(m_threshold * (x1 - x0) * (y1 - y0)))
+                    continue;
+                const int ux1 = (x1 + m_unitSize - 1) / m_unitSize;
+                const int uy1 = (y1 + m_unitSize - 1) / m_unitSize;
+                for (int uy = y0 / m_unitSize; uy < uy1; uy++) {
+                    for (int ux = x0 / m_unitSize; ux < ux1; ux++)
+                        m_activeUnits[uy * unitsX + ux] = 1;
+                }
+            }
+        }
+    }
+
+    QVector<QPoint> motionUnits;
+    for (int uy = 0; uy < unitsY; uy++) {
+        for (int ux = 0; ux < unitsX; ux++) {
+            if (m_activeUnits[uy * unitsX + ux])
+                motionUnits.append(QPoint(ux, uy));
+        }
+    }
+    return motionUnits;
+}
+
+// one luma sample per step x step cell, taken from its top left pixel. an
+// xRGB frame goes through the same luma() as the full resolution pass, a
+// luma frame is only picked from, so idle samples always compare like for like
+void MotionDetector::subsampleLuma(const QImage &image, int step, QImage &target) const
+{
+    const QSize size((image.width() + step - 1) / step, (image.height() + step - 1) / step);
+    if (target.size() != size || target.format() != QImage::Format_Grayscale8)
+        target = QImage(size, QImage::Format_Grayscale8);
+    const bool fromLuma = image.format() == QImage::Format_Grayscale8;
+    for (int y = 0; y < size.height(); y++) {
+        const uchar *source = image.constScanLine(y * step);
+        uchar *line = target.scanLine(y);
+        if (fromLuma) {
+            for (int x = 0; x < size.width(); x++)
+                line[x] = source[x * step];
+        } else {
+            const QRgb *pixels = reinterpret_cast<const QRgb *>(source);
+            for (int x = 0; x < size.width(); x++)
+                line[x] = uchar(luma(pixels[x * step]));
+        }
+    }
+}
+
+void MotionDetector::blendPass(QImage &image, int blend, bool writeLuma)
+{
+    if (writeLuma && m_currentLuma.size() != image.size())
+        m_currentLuma = QImage(image.size(), QImage::Format_Grayscale8);
+    if (blend > 0 && writeLuma)
+        fusedLumaPass<true, true, false>(image, blend, &m_currentLuma, nullptr, nullptr);
+    else if (blend > 0)
+        fusedLumaPass<true, false, false>(image, blend, nullptr, nullptr, nullptr);
+    else if (writeLuma)
+        fusedLumaPass<false, true, false>(image, blend, &m_currentLuma, nullptr, nullptr);
+}
+
 QVector<QRect> MotionDetector::detect(const QImage &QtImage)
+{
+    // analysis only, nothing is written to the image without blending
+    QImage image = QtImage;
+    return blendAndDetect(image, 0);
+}
+
+QVector<QRect> MotionDetector::blendAndDetect(QImage &image, int grayscaleValue)
 {
     QVector<QRect> motionRectangles;
+    m_motionField.clear();
+    m_motionValid.clear();
+    m_rectangleMotion.clear();
 
-    if (!m_enabled || m_previousFrame.isNull() || m_previousFrame.size() != QtImage.size()) {
-        if (m_previousFrame.size() != QtImage.size()) {
-            m_previousFrame = QImage(QtImage.size(), QImage::Format_RGB32);
-            m_previousFrame.fill(Qt::black);
-        } else {
-            m_previousFrame = QtImage.copy();
-        }
-        return motionRectangles; // return empty vector
-    }
-
-    QImage grayPrevious = m_previousFrame.convertToFormat(QImage::Format_Grayscale8);
-    QImage grayCurrent = QtImage.convertToFormat(QImage::Format_Grayscale8);
-    const int blockSize = 16;
-    const int width = grayCurrent.width();
-    const int height = grayCurrent.height();
-    QVector<QPoint> motionBlocks;
-    for (int y = 0; y < height; y += blockSize) {
-        for (int x = 0; x < width; x += blockSize) {
-            int diffSum = 0, pixelCount = 0;
-            for (int by = 0; by < blockSize && y + by < height; by++) {
-                const uchar *prevLine = grayPrevious.constScanLine(y + by);
-                const uchar *currLine = grayCurrent.constScanLine(y + by);
-                for (int bx = 0; bx < blockSize && x + bx < width; bx++) {
-                    int diff = qAbs(prevLine[x + bx] - currLine[x + bx]);
-                    diffSum += diff;
-                    pixelCount++;
-                }
+    if (!isXrgb32(image.format()))
+        image = image.convertToFormat(QImage::Format_RGB32);
+    const int blend = qBound(0, grayscaleValue * 256 / 100, 256);
+
+    if (!m_enabled) {
+        m_previousFrame = QImage();
+        blendPass(image, blend, false);
+        return motionRectangles;
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+    QVector<QPoint> motionUnits;
+
+    if (m_idle) {
+        // sample before blending, the full resolution pass also takes luma from the unblended pixels
+        subsampleLuma(image, IdleSampleStep, m_currentLuma);
+        blendPass(image, blend, false);
+        const QImage &grayCurrent = m_currentLuma;
+        if (m_previousFrame.size() != grayCurrent.size()) {
+            m_previousFrame.swap(m_currentLuma);
+            return motionRectangles;
+        }
+
+        // every sampled pixel stands in for the whole cell it came from
+        m_cellsX = (width + CellSize - 1) / CellSize;
+        m_cellsY = (height + CellSize - 1) / CellSize;
+        m_cellSums.fill(0, m_cellsX * m_cellsY);
+        qint64 shiftTotal = 0, samples = 0;
+        for (int y = 0; y < grayCurrent.height() && y < m_cellsY; y++) {
+            const uchar *prevLine = m_previousFrame.constScanLine(y);
+            const uchar *currLine = grayCurrent.constScanLine(y);
+            quint32 *cells = m_cellSums.data() + y * m_cellsX;
+            const int columns = qMin(grayCurrent.width(), m_cellsX);
+            for (int x = 0; x < columns; x++) {
+                const int shift = currLine[x] - prevLine[x];
+                cells[x] = qAbs(shift) * CellSize * CellSize;
+                shiftTotal += shift;
+            }
+            samples += columns;
+        }
+        buildIntegral();
+        motionUnits = findMotionUnits(width, height);
+        if (isGlobalChange(motionUnits.size())) {
+            emit sceneChanged(double(motionUnits.size()) / m_activeUnits.size(),
+                              samples > 0 ? double(shiftTotal) / samples : 0.0);
+            motionUnits.clear();
+        }
+        m_previousFrame.swap(m_currentLuma);
+    } else {
+        if (m_previousFrame.size() != image.size() || m_previousFrame.format() != QImage::Format_Grayscale8) {
+            blendPass(image, blend, true);
+            m_previousFrame.swap(m_currentLuma);
+            return motionRectangles; // return empty vector
+        }
+
+        m_cellsX = (width + CellSize - 1) / CellSize;
+        m_cellsY = (height + CellSize - 1) / CellSize;
+        m_cellSums.fill(0, m_cellsX * m_cellsY);
+        if (m_currentLuma.size() != image.size())
+            m_currentLuma = QImage(image.size(), QImage::Format_Grayscale8);
+        qint64 lumaTotal = 0, shiftTotal = 0;
+        if (blend > 0)
+            fusedLumaPass<true, true, true>(image, blend, &m_currentLuma, &m_previousFrame, m_cellSums.data(),
+                                            &lumaTotal, &shiftTotal);
+        else
+            fusedLumaPass<false, true, true>(image, blend, &m_currentLuma, &m_previousFrame, m_cellSums.data(),
+                                             &lumaTotal, &shiftTotal);
+        buildIntegral();
+        motionUnits = findMotionUnits(width, height);
+
+        // lights switching or the camera re-exposing lights up nearly every
+        // block at once, that is not motion and not worth labelling
+        if (isGlobalChange(motionUnits.size())) {
+            const qint64 previousTotal = lumaTotal - shiftTotal;
+            const double gain = previousTotal > 0 ? double(lumaTotal) / previousTotal : 1.0;
+            if (m_gainCompensationEnabled && qAbs(gain - 1.0) > 0.02) {
+                m_cellSums.fill(0);
+                compensatedDifference(m_currentLuma, m_previousFrame, gain, m_cellSums.data());
+                buildIntegral();
+                motionUnits = findMotionUnits(width, height);
             }
-            float avgChange = pixelCount > 0 ? diffSum / (float)pixelCount : 0;
-            if (avgChange > m_threshold) {
-                motionBlocks.append(QPoint(x / blockSize, y / blockSize));
+            if (isGlobalChange(motionUnits.size())) {
+                emit sceneChanged(double(motionUnits.size()) / m_activeUnits.size(),
+                                  double(shiftTotal) / (qint64(width) * height));
+                motionUnits.clear();
             }
         }
+
+        if (m_motionEstimationEnabled && !motionUnits.isEmpty())
+            estimateMotion(motionUnits, m_currentLuma, m_previousFrame);
+        m_previousFrame.swap(m_currentLuma);
+    }
+
+    if (!motionUnits.isEmpty())
+        motionRectangles = unitsToRectangles(width, height);
+
+    if (!motionRectangles.isEmpty()) {
+        m_lastMotionTimer.restart();
+        if (m_idle) {
+            // wake up, the next frame is compared at full resolution
+            setIdle(false);
+            blendPass(image, 0, true);
+            m_previousFrame.swap(m_currentLuma);
+        }
+    } else if (m_lowPowerEnabled && !m_idle && m_lastMotionTimer.hasExpired(m_idleTimeout)) {
+        setIdle(true);
+        subsampleLuma(m_previousFrame, IdleSampleStep, m_currentLuma);
+        m_previousFrame.swap(m_currentLuma);
     }
 
-    if (!motionBlocks.isEmpty()) {
-        QVector<int> labels(motionBlocks.size(), -1);
-        int nextLabel = 0;
-        for (int i = 0; i < motionBlocks.size(); i++) {
-            if (labels[i] >= 0)
-                continue;
-            QQueue<int> queue;
-            queue.enqueue(i);
-            labels[i] = nextLabel;
-            while (!queue.isEmpty()) {
-                int idx = queue.dequeue();
-                QPoint current = motionBlocks[idx];
-                for (int j = 0; j < motionBlocks.size(); j++) {
-                    if (labels[j] >= 0)
-                        continue;
-                    QPoint neighbor = motionBlocks[j];
-                    if (qAbs(neighbor.x() - current.x()) <= 1 && qAbs(neighbor.y() - current.y()) <= 1) {
-                        labels[j] = nextLabel;
-                        queue.enqueue(j);
+    return motionRectangles;
+}
+
+QVector<QRect> MotionDetector::unitsToRectangles(int width, int height)
+{
+    QVector<QRect> motionRectangles;
+
+    // 8-connected flood fill over the unit grid, components come out in raster order
+    const int unitsX = (width + m_unitSize - 1) / m_unitSize;
+    const int unitsY = (height + m_unitSize - 1) / m_unitSize;
+    QVector<int> labels(unitsX * unitsY, -1);
+    QVector<QVector<QPoint>> componentUnits;
+    for (int start = 0; start < labels.size(); start++) {
+        if (!m_activeUnits[start] || labels[start] >= 0)
+            continue;
+        const int label = componentUnits.size();
+        componentUnits.append(QVector<QPoint>());
+        QQueue<int> queue;
+        queue.enqueue(start);
+        labels[start] = label;
+        while (!queue.isEmpty()) {
+            const int idx = queue.dequeue();
+            const int ux = idx % unitsX, uy = idx / unitsX;
+            componentUnits[label].append(QPoint(ux, uy));
+            for (int ny = qMax(0, uy - 1); ny <= qMin(unitsY - 1, uy + 1); ny++) {
+                for (int nx = qMax(0, ux - 1); nx <= qMin(unitsX - 1, ux + 1); nx++) {
+                    const int neighbor = ny * unitsX + nx;
+                    if (m_activeUnits[neighbor] && labels[neighbor] < 0) {
+                        labels[neighbor] = label;
+                        queue.enqueue(neighbor);
                     }
                 }
             }
-            nextLabel++;
-        }
-
-        QVector<QVector<QPoint>> componentBlocks(nextLabel);
-        for (int i = 0; i < labels.size(); i++) {
-            if (labels[i] >= 0)
-                componentBlocks[labels[i]].append(motionBlocks[i]);
-        }
-        for (const QVector<QPoint> &component : componentBlocks) {
-            if (component.size() < m_sensitivity / 3)
-                continue;
-            int minX = width, minY = height, maxX = 0, maxY = 0;
-            for (const QPoint &p : component) {
-                minX = qMin(minX, p.x() * blockSize);
-                minY = qMin(minY, p.y() * blockSize);
-                maxX = qMax(maxX, (p.x() + 1) * blockSize);
-                maxY = qMax(maxY, (p.y() + 1) * blockSize);
-            }
-            QRect rect(qMax(0, minX), qMax(0, minY), qMin(width, maxX) - minX, qMin(height, maxY) - minY);
-            if (rect.width() > blockSize * 2 && rect.height() > blockSize * 2)
-                motionRectangles.append(rect);
         }
     }
-    m_previousFrame = QtImage.copy();
 
+    // sensitivity counts full size blocks, whatever the unit size is
+    const int minimumUnits = (m_sensitivity / 3) * (m_blockSize / m_unitSize) * (m_blockSize / m_unitSize);
+    const bool withMotion = !m_motionValid.isEmpty();
+    for (const QVector<QPoint> &component : componentUnits) {
+        if (component.size() < minimumUnits)
+            continue;
+        int minX = width, minY = height, maxX = 0, maxY = 0;
+        QPointF motionSum;
+        int motionCount = 0;
+        for (const QPoint &p : component) {
+            minX = qMin(minX, p.x() * m_unitSize);
+            minY = qMin(minY, p.y() * m_unitSize);
+            maxX = qMax(maxX, (p.x() + 1) * m_unitSize);
+            maxY = qMax(maxY, (p.y() + 1) * m_unitSize);
+            const int index = p.y() * m_motionFieldColumns + p.x();
+            if (withMotion && m_motionValid[index]) {
+                motionSum += m_motionField[index];
+                motionCount++;
+            }
+        }
+        QRect rect(qMax(0, minX), qMax(0, minY), qMin(width, maxX) - minX, qMin(height, maxY) - minY);
+        if (rect.width() > m_blockSize * 2 && rect.height() > m_blockSize * 2) {
+            motionRectangles.append(rect);
+            if (withMotion)
+                m_rectangleMotion.append(motionCount > 0 ? motionSum / motionCount : QPointF());
+        }
+    }
     return motionRectangles;
 }
@@ -5,7 +5,9 @@
 #include <QImage>
 #include <QVector>
 #include <QRect>
+#include <QPointF>
 #include <QQueue>
+#include <QElapsedTimer>
 
 class MotionDetector : public QObject
 {
@@ -14,16 +16,88 @@ public:
     explicit MotionDetector(QObject *parent = nullptr);
 
     QVector<QRect> detect(const QImage &QtImage);
+    // same as detect() but also applies the grayscale effect (0-100) to the
+    // image in the same pass over the pixels
+    QVector<QRect> blendAndDetect(QImage &image, int grayscaleValue);
 
     void setEnabled(bool enabled);
     void setThreshold(int threshold);
     void setSensitivity(int sensitivity);
 
+    // block statistics come from a summed area table, so the block size, a
+    // second grid shifted by half a block and extra scales (multiples of the
+    // block size) cost the same per pixel as a single 16x16 grid
+    void setBlockSize(int blockSize);
+    void setShiftedGridEnabled(bool enabled);
+    void setScales(const QVector<int> &scales);
+
+    // frames where more than this fraction of the blocks changed are treated
+    // as a global illumination change instead of motion (0 disables)
+    void setSceneChangeFraction(double fraction);
+    // on such a frame first retry with the previous frame scaled by the
+    // brightness ratio, so real motion under a new exposure still counts
+    void setGainCompensationEnabled(bool enabled);
+
+    // low power: after idleTimeout ms without a hit, analyse a subsampled frame
+    void setLowPowerEnabled(bool enabled);
+    void setIdleTimeout(int msecs);
+    bool isIdle() const;
+
+    // block matching on the changed blocks to tell which way things move
+    void setMotionEstimationEnabled(bool enabled);
+    // displacement since the previous frame per detection unit (a block, or
+    // half a block with the shifted grid), row major, only entries flagged
+    // in motionVectorValid() were estimated
+    const QVector<QPoint> &motionVectorField() const;
+    const QVector<bool> &motionVectorValid() const;
+    int motionFieldColumns() const;
+    // mean displacement per rectangle returned by the last detect call
+    const QVector<QPointF> &rectangleMotion() const;
+
+signals:
+    void idleChanged(bool idle);
+    void sceneChanged(double activeFraction, double meanLumaShift);
+
 private:
+    void subsampleLuma(const QImage &image, int step, QImage &target) const;
+    void blendPass(QImage &image, int blend, bool writeLuma);
+    bool isGlobalChange(int activeUnits) const;
+    void buildIntegral();
+    quint32 cellRectSum(int cx0, int cy0, int cx1, int cy1) const;
+    QVector<QPoint> findMotionUnits(int width, int height);
+    void estimateMotion(const QVector<QPoint> &motionUnits, const QImage &current, const QImage &previous);
+    QVector<QRect> unitsToRectangles(int width, int height);
+    void setIdle(bool idle);
+
     bool m_enabled;
     int m_threshold;
     int m_sensitivity;
-    QImage m_previousFrame;
+    QImage m_previousFrame; // luma of the last frame, subsampled while idle
+    QImage m_currentLuma;
+
+    int m_blockSize;
+    bool m_shiftedGrid;
+    QVector<int> m_scales;
+    int m_unitSize;
+    int m_cellsX;
+    int m_cellsY;
+    QVector<quint32> m_cellSums;
+    QVector<quint32> m_integral;
+    QVector<uchar> m_activeUnits;
+
+    double m_sceneChangeFraction;
+    bool m_gainCompensationEnabled;
+
+    bool m_lowPowerEnabled;
+    bool m_idle;
+    int m_idleTimeout;
+    QElapsedTimer m_lastMotionTimer;
+
+    bool m_motionEstimationEnabled;
+    int m_motionFieldColumns;
+    QVector<QPoint> m_motionField;
+    QVector<bool> m_motionValid;
+    QVector<QPointF> m_rectangleMotion;
 };
 
 #endif // MOTIONDETECTOR_H
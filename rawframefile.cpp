@@ -0,0 +1,112 @@
+#include "rawframefile.h"
+#include <QImage>
+#include <QDebug>
+#include <cstring>
+
+static qint64 alignedSize(qint64 size)
+{
+    return (size + RawFrameAlignment - 1) & ~qint64(RawFrameAlignment - 1);
+}
+
+static bool writePadding(QFile &file, qint64 written)
+{
+    static const char zeros[RawFrameAlignment] = {};
+    qint64 padding = alignedSize(written) - written;
+    return padding == 0 || file.write(zeros, padding) == padding;
+}
+
+RawFrameWriter::RawFrameWriter(QObject *parent) : QObject(parent)
+{
+}
+
+RawFrameWriter::~RawFrameWriter()
+{
+    close();
+}
+
+bool RawFrameWriter::open(const QString &filePath)
+{
+    close();
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    RawFrameFileHeader header = {};
+    memcpy(header.magic, RawFrameFileMagic, sizeof(header.magic));
+    header.version = RawFrameFileVersion;
+    header.headerSize = sizeof(RawFrameFileHeader);
+    if (m_file.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header)) {
+        m_file.close();
+        return false;
+    }
+
+    m_recordOffsets.clear();
+    m_clock.start();
+    return true;
+}
+
+void RawFrameWriter::close()
+{
+    if (!m_file.isOpen())
+        return;
+
+    RawFrameFileFooter footer = {};
+    footer.indexOffset = m_file.pos();
+    footer.frameCount = m_recordOffsets.size();
+    memcpy(footer.magic, RawFrameIndexMagic, sizeof(footer.magic));
+
+    qint64 indexBytes = m_recordOffsets.size() * qint64(sizeof(quint64));
+    m_file.write(reinterpret_cast<const char *>(m_recordOffsets.constData()), indexBytes);
+    writePadding(m_file, indexBytes);
+    m_file.write(reinterpret_cast<const char *>(&footer), sizeof(footer));
+    m_file.close();
+    qDebug() << "raw frame dump closed," << footer.frameCount << "frames written to" << m_file.fileName();
+}
+
+bool RawFrameWriter::isOpen() const
+{
+    return m_file.isOpen();
+}
+
+int RawFrameWriter::frameCount() const
+{
+    return m_recordOffsets.size();
+}
+
+QString RawFrameWriter::errorString() const
+{
+    return m_file.errorString();
+}
+
+void RawFrameWriter::writeFrame(const QVideoFrame &frame)
+{
+    if (!m_file.isOpen() || !frame.isValid())
+        return;
+
+    QImage image = frame.toImage();
+    if (image.isNull())
+        return;
+    if (image.format() != QImage::Format_RGB32 &&
+        image.format() != QImage::Format_ARGB32 &&
+        image.format() != QImage::Format_ARGB32_Premultiplied)
+        image = image.convertToFormat(QImage::Format_RGB32);
+
+    RawFrameRecordHeader record = {};
+    record.magic = RawFrameRecordMagic;
+    record.format = image.format();
+    record.timestampUs = frame.startTime() >= 0 ? frame.startTime() : m_clock.nsecsElapsed() / 1000;
+    record.width = image.width();
+    record.height = image.height();
+    record.bytesPerLine = image.bytesPerLine();
+    record.dataSize = image.sizeInBytes();
+
+    quint64 offset = m_file.pos();
+    bool ok = m_file.write(reinterpret_cast<const char *>(&record), sizeof(record)) == sizeof(record);
+    ok = ok && m_file.write(reinterpret_cast<const char *>(image.constBits()), record.dataSize) == record.dataSize;
+    ok = ok && writePadding(m_file, record.dataSize);
+    if (!ok) {
+        qWarning() << "failed to write raw frame:" << m_file.errorString();
+        return;
+    }
+    m_recordOffsets.append(offset);
+}
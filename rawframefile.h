@@ -0,0 +1,79 @@
+#ifndef RAWFRAMEFILE_H
+#define RAWFRAMEFILE_H
+
+#include <QObject>
+#include <QVideoFrame>
+#include <QFile>
+#include <QVector>
+#include <QElapsedTimer>
+
+// on-disk layout of a raw frame dump (native byte order, everything 32 byte aligned):
+//
+//   RawFrameFileHeader
+//   { RawFrameRecordHeader, pixel data padded to 32 bytes } * frameCount
+//   quint64 recordOffsets[frameCount]
+//   RawFrameFileFooter
+//
+// the footer is only written on close, a dump cut short by a crash is still
+// readable by scanning the records from the front
+
+constexpr char RawFrameFileMagic[8] = { 'M', 'D', 'R', 'A', 'W', 'F', 'R', '1' };
+constexpr char RawFrameIndexMagic[8] = { 'M', 'D', 'I', 'N', 'D', 'E', 'X', '1' };
+constexpr quint32 RawFrameRecordMagic = 0x5246444d; // "MDFR"
+constexpr quint32 RawFrameFileVersion = 1;
+constexpr int RawFrameAlignment = 32;
+
+struct RawFrameFileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 headerSize;
+    quint64 reserved[2];
+};
+
+struct RawFrameRecordHeader
+{
+    quint32 magic;
+    quint32 format;       // QImage::Format
+    qint64 timestampUs;
+    quint32 width;
+    quint32 height;
+    quint32 bytesPerLine;
+    quint32 dataSize;
+};
+
+struct RawFrameFileFooter
+{
+    quint64 indexOffset;
+    quint64 frameCount;
+    char magic[8];
+    quint64 reserved;
+};
+
+static_assert(sizeof(RawFrameFileHeader) == RawFrameAlignment, "header must stay aligned");
+static_assert(sizeof(RawFrameRecordHeader) == RawFrameAlignment, "record header must stay aligned");
+static_assert(sizeof(RawFrameFileFooter) == RawFrameAlignment, "footer must stay aligned");
+
+class RawFrameWriter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit RawFrameWriter(QObject *parent = nullptr);
+    ~RawFrameWriter();
+
+    bool open(const QString &filePath);
+    void close();
+    bool isOpen() const;
+    int frameCount() const;
+    QString errorString() const;
+
+public slots:
+    void writeFrame(const QVideoFrame &frame);
+
+private:
+    QFile m_file;
+    QVector<quint64> m_recordOffsets;
+    QElapsedTimer m_clock;
+};
+
+#endif // RAWFRAMEFILE_H
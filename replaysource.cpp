@@ -0,0 +1,221 @@
+#include "replaysource.h"
+#include <QImage>
+#include <QTimer>
+#include <QDebug>
+#include <cstring>
+
+ReplaySource::ReplaySource(QObject *parent)
+    : FrameSource(parent),
+    m_data(nullptr),
+    m_size(0),
+    m_clockOffsetUs(0),
+    m_position(0),
+    m_realTime(true),
+    m_running(false)
+{
+    m_timer = new QTimer(this);
+    m_timer->setSingleShot(true);
+    m_timer->setTimerType(Qt::PreciseTimer);
+    connect(m_timer, &QTimer::timeout, this, &ReplaySource::emitNextFrame);
+}
+
+ReplaySource::~ReplaySource()
+{
+    stop();
+    if (m_data)
+        m_file.unmap(m_data);
+}
+
+bool ReplaySource::open(const QString &filePath)
+{
+    stop();
+    if (m_data) {
+        m_file.unmap(m_data);
+        m_data = nullptr;
+    }
+    m_file.close();
+    m_recordOffsets.clear();
+    m_position = 0;
+
+    m_file.setFileName(filePath);
+    if (!m_file.open(QIODevice::ReadOnly)) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+    m_size = m_file.size();
+    if (m_size < qint64(sizeof(RawFrameFileHeader))) {
+        m_errorString = "file too small to be a frame dump";
+        return false;
+    }
+    m_data = m_file.map(0, m_size);
+    if (!m_data) {
+        m_errorString = m_file.errorString();
+        return false;
+    }
+
+    const RawFrameFileHeader *header = reinterpret_cast<const RawFrameFileHeader *>(m_data);
+    if (memcmp(header->magic, RawFrameFileMagic, sizeof(header->magic)) != 0 ||
+        header->version != RawFrameFileVersion) {
+        m_errorString = "not a frame dump or unsupported version";
+        return false;
+    }
+
+    if (!buildIndex()) {
+        m_errorString = "frame dump contains no frames";
+        return false;
+    }
+    return true;
+}
+
+// everything emitNextFrame hands to QImage has to stay inside the record
+// and the mapping, a dump cut short or corrupted must not be read past
+bool ReplaySource::isValidRecord(quint64 offset) const
+{
+    const quint64 recordSize = sizeof(RawFrameRecordHeader);
+    if (offset % RawFrameAlignment != 0 || offset < sizeof(RawFrameFileHeader) ||
+        offset > quint64(m_size) || quint64(m_size) - offset < recordSize)
+        return false;
+
+    const RawFrameRecordHeader *header = reinterpret_cast<const RawFrameRecordHeader *>(m_data + offset);
+    if (header->magic != RawFrameRecordMagic ||
+        header->dataSize > quint64(m_size) - offset - recordSize)
+        return false;
+    if (header->format != QImage::Format_RGB32 &&
+        header->format != QImage::Format_ARGB32 &&
+        header->format != QImage::Format_ARGB32_Premultiplied)
+        return false;
+    return header->width > 0 && header->height > 0 && header->bytesPerLine % 4 == 0 &&
+           header->bytesPerLine >= quint64(header->width) * 4 &&
+           quint64(header->bytesPerLine) * header->height <= header->dataSize;
+}
+
+bool ReplaySource::buildIndex()
+{
+    const qint64 recordSize = sizeof(RawFrameRecordHeader);
+    const qint64 footerSize = sizeof(RawFrameFileFooter);
+
+    // use the index written on close when it is there and sane
+    if (m_size >= qint64(sizeof(RawFrameFileHeader)) + footerSize) {
+        const RawFrameFileFooter *footer =
+            reinterpret_cast<const RawFrameFileFooter *>(m_data + m_size - footerSize);
+        const quint64 indexEnd = m_size - footerSize;
+        if (memcmp(footer->magic, RawFrameIndexMagic, sizeof(footer->magic)) == 0 &&
+            footer->indexOffset % RawFrameAlignment == 0 && footer->indexOffset <= indexEnd &&
+            footer->frameCount <= (indexEnd - footer->indexOffset) / sizeof(quint64)) {
+            const quint64 *offsets = reinterpret_cast<const quint64 *>(m_data + footer->indexOffset);
+            m_recordOffsets.reserve(footer->frameCount);
+            for (quint64 i = 0; i < footer->frameCount; i++) {
+                if (!isValidRecord(offsets[i]))
+                    break;
+                m_recordOffsets.append(offsets[i]);
+            }
+            return !m_recordOffsets.isEmpty();
+        }
+    }
+
+    // no index, walk the records until the data runs out
+    qint64 offset = sizeof(RawFrameFileHeader);
+    while (isValidRecord(offset)) {
+        const RawFrameRecordHeader *header = reinterpret_cast<const RawFrameRecordHeader *>(m_data + offset);
+        m_recordOffsets.append(offset);
+        offset += recordSize + ((quint64(header->dataSize) + RawFrameAlignment - 1) & ~quint64(RawFrameAlignment - 1));
+    }
+    qDebug() << "frame dump has no index, recovered" << m_recordOffsets.size() << "frames by scanning";
+    return !m_recordOffsets.isEmpty();
+}
+
+QString ReplaySource::errorString() const
+{
+    return m_errorString;
+}
+
+void ReplaySource::setRealTime(bool realTime)
+{
+    m_realTime = realTime;
+}
+
+bool ReplaySource::isRealTime() const
+{
+    return m_realTime;
+}
+
+int ReplaySource::frameCount() const
+{
+    return m_recordOffsets.size();
+}
+
+int ReplaySource::position() const
+{
+    return m_position;
+}
+
+bool ReplaySource::seek(int index)
+{
+    if (index < 0 || index >= m_recordOffsets.size())
+        return false;
+    m_position = index;
+    if (m_running) {
+        m_clock.restart();
+        m_clockOffsetUs = record(m_position)->timestampUs;
+        scheduleNextFrame();
+    }
+    return true;
+}
+
+void ReplaySource::start()
+{
+    if (m_running || m_recordOffsets.isEmpty())
+        return;
+    if (m_position >= m_recordOffsets.size())
+        m_position = 0;
+    m_running = true;
+    m_clock.start();
+    m_clockOffsetUs = record(m_position)->timestampUs;
+    scheduleNextFrame();
+}
+
+void ReplaySource::stop()
+{
+    m_running = false;
+    m_timer->stop();
+}
+
+const RawFrameRecordHeader *ReplaySource::record(int index) const
+{
+    return reinterpret_cast<const RawFrameRecordHeader *>(m_data + m_recordOffsets[index]);
+}
+
+void ReplaySource::scheduleNextFrame()
+{
+    if (!m_realTime || m_position >= m_recordOffsets.size()) {
+        m_timer->start(0);
+        return;
+    }
+    qint64 dueUs = record(m_position)->timestampUs - m_clockOffsetUs;
+    qint64 delayMs = (dueUs - m_clock.nsecsElapsed() / 1000) / 1000;
+    m_timer->start(int(qMax<qint64>(0, delayMs)));
+}
+
+void ReplaySource::emitNextFrame()
+{
+    if (!m_running)
+        return;
+    if (m_position >= m_recordOffsets.size()) {
+        m_running = false;
+        emit finished();
+        return;
+    }
+
+    const RawFrameRecordHeader *header = record(m_position);
+    const uchar *pixels = reinterpret_cast<const uchar *>(header) + sizeof(RawFrameRecordHeader);
+    QImage image(pixels, header->width, header->height, header->bytesPerLine,
+                 static_cast<QImage::Format>(header->format));
+    QVideoFrame frame(image);
+    frame.setStartTime(header->timestampUs);
+    m_position++;
+
+    emit frameAvailable(frame);
+
+    if (m_running)
+        scheduleNextFrame();
+}
@@ -0,0 +1,57 @@
+#ifndef REPLAYSOURCE_H
+#define REPLAYSOURCE_H
+
+#include "framesource.h"
+#include "rawframefile.h"
+#include <QFile>
+#include <QVector>
+#include <QElapsedTimer>
+
+class QTimer;
+
+// plays back a dump written by RawFrameWriter straight out of a memory
+// mapping, the emitted frames point into the mapped file without copying
+class ReplaySource : public FrameSource
+{
+    Q_OBJECT
+public:
+    explicit ReplaySource(QObject *parent = nullptr);
+    ~ReplaySource();
+
+    bool open(const QString &filePath);
+    QString errorString() const;
+
+    // true replays at the recorded pace, false emits frames as fast as they are consumed
+    void setRealTime(bool realTime);
+    bool isRealTime() const;
+
+    int frameCount() const;
+    int position() const;
+    bool seek(int index);
+
+    void start() override;
+    void stop() override;
+
+private slots:
+    void emitNextFrame();
+
+private:
+    const RawFrameRecordHeader *record(int index) const;
+    bool isValidRecord(quint64 offset) const;
+    bool buildIndex();
+    void scheduleNextFrame();
+
+    QFile m_file;
+    uchar *m_data;
+    qint64 m_size;
+    QVector<qint64> m_recordOffsets;
+    QString m_errorString;
+    QTimer *m_timer;
+    QElapsedTimer m_clock;
+    qint64 m_clockOffsetUs;
+    int m_position;
+    bool m_realTime;
+    bool m_running;
+};
+
+#endif // REPLAYSOURCE_H
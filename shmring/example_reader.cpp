@@ -0,0 +1,72 @@
+// follows the frame ring published by the motion detector (--shm-ring <name>)
+// and prints what it sees, working on the frames in place without copying them
+//
+//   framering_example [name]
+
+#include "framering.h"
+
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+int main(int argc, char *argv[])
+{
+    const char *name = argc > 1 ? argv[1] : "/motiondetector";
+
+    framering::FrameRingReader reader;
+    framering::FrameView view;
+    for (;;) {
+        if (!reader.isOpen() || reader.closed()) {
+            // first start, or the writer replaced the ring, e.g. after the camera resolution changed
+            while (!reader.open(name)) {
+                std::fprintf(stderr, "waiting for ring %s: %s\n", name, reader.errorString().c_str());
+                std::this_thread::sleep_for(std::chrono::seconds(1));
+            }
+            std::printf("attached to %s, %u slots\n", name, reader.slotCount());
+        }
+
+        if (!reader.next(view)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            continue;
+        }
+
+        // the header can change under us until stillValid() confirms it, so the
+        // geometry is read once and kept inside the slot before any pixel is touched
+        const framering::SlotHeader &frame = *view.slot;
+        const uint32_t width = frame.width;
+        const uint32_t height = frame.height;
+        const uint32_t bytesPerLine = frame.bytesPerLine;
+        const bool fits = uint64_t(width) * 4 <= bytesPerLine
+                          && uint64_t(bytesPerLine) * height <= reader.maxFrameBytes();
+
+        // average brightness straight out of shared memory
+        uint64_t sum = 0;
+        for (uint32_t y = 0; fits && y < height; y += 4) {
+            const uint32_t *line = reinterpret_cast<const uint32_t *>(view.pixels + uint64_t(y) * bytesPerLine);
+            for (uint32_t x = 0; x < width; x += 4)
+                sum += (line[x] >> 8) & 0xff;
+        }
+        uint64_t samples = uint64_t((width + 3) / 4) * ((height + 3) / 4);
+        uint64_t frameNumber = frame.frameNumber;
+        uint32_t rectCount = frame.rectCount < framering::MaxRects ? frame.rectCount : framering::MaxRects;
+        framering::Rect first = rectCount ? frame.rects[0] : framering::Rect{0, 0, 0, 0};
+
+        if (!reader.stillValid(view)) {
+            std::printf("frame %llu was overwritten while reading it, skipped\n",
+                        static_cast<unsigned long long>(frameNumber));
+            continue;
+        }
+        if (!fits) {
+            std::printf("frame %llu claims %ux%u with %u bytes per line, more than a slot holds, skipped\n",
+                        static_cast<unsigned long long>(frameNumber), width, height, bytesPerLine);
+            continue;
+        }
+
+        std::printf("frame %llu %ux%u brightness %llu, %u motion rects",
+                    static_cast<unsigned long long>(frameNumber), width, height,
+                    static_cast<unsigned long long>(samples ? sum / samples : 0), rectCount);
+        if (rectCount)
+            std::printf(" (first %d,%d %dx%d)", first.x, first.y, first.width, first.height);
+        std::printf(", %llu dropped\n", static_cast<unsigned long long>(reader.droppedFrames()));
+    }
+}
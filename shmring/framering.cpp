@@ -0,0 +1,271 @@
+#include "framering.h"
+
+#include <cstring>
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FRAMERING_POSIX 1
+#endif
+
+namespace framering {
+
+static uint64_t alignUp(uint64_t value)
+{
+    return (value + 63) & ~uint64_t(63);
+}
+
+static std::string shmName(const std::string &name)
+{
+    return name.empty() || name[0] == '/' ? name : "/" + name;
+}
+
+static uint64_t slotHeaderSize()
+{
+    return alignUp(sizeof(SlotHeader));
+}
+
+static SlotHeader *slotAt(const RingHeader *header, uint32_t index)
+{
+    uint8_t *base = reinterpret_cast<uint8_t *>(const_cast<RingHeader *>(header));
+    return reinterpret_cast<SlotHeader *>(base + alignUp(sizeof(RingHeader)) + index * header->slotSize);
+}
+
+FrameRingWriter::~FrameRingWriter()
+{
+    close();
+}
+
+bool FrameRingWriter::create(const std::string &name, uint32_t slotCount, uint64_t maxFrameBytes)
+{
+    close();
+#ifdef FRAMERING_POSIX
+    if (slotCount < 2) {
+        m_error = "a ring needs at least two slots";
+        return false;
+    }
+    m_name = shmName(name);
+    uint64_t slotSize = slotHeaderSize() + alignUp(maxFrameBytes);
+    size_t size = alignUp(sizeof(RingHeader)) + slotCount * slotSize;
+
+    // start from a fresh object so readers of an older, differently sized ring can't get confused
+    shm_unlink(m_name.c_str());
+    int fd = shm_open(m_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd < 0) {
+        m_error = std::string("shm_open failed: ") + strerror(errno);
+        return false;
+    }
+    if (ftruncate(fd, size) != 0) {
+        m_error = std::string("ftruncate failed: ") + strerror(errno);
+        ::close(fd);
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+    void *memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        m_error = std::string("mmap failed: ") + strerror(errno);
+        shm_unlink(m_name.c_str());
+        return false;
+    }
+
+    // ftruncate zero fills, so every slot starts out with sequence 0 (empty)
+    m_header = new (memory) RingHeader;
+    m_mappedSize = size;
+    m_header->version = Version;
+    m_header->slotCount = slotCount;
+    m_header->closed.store(0, std::memory_order_relaxed);
+    m_header->slotSize = slotSize;
+    m_header->maxFrameBytes = maxFrameBytes;
+    m_header->writeCount.store(0, std::memory_order_relaxed);
+    for (uint32_t i = 0; i < slotCount; i++)
+        new (slotAt(m_header, i)) SlotHeader();
+    // magic last, a reader that sees it sees a fully initialised header
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->magic = Magic;
+    return true;
+#else
+    (void)name;
+    (void)slotCount;
+    (void)maxFrameBytes;
+    m_error = "shared memory frame rings are only supported on POSIX systems";
+    return false;
+#endif
+}
+
+void FrameRingWriter::close()
+{
+#ifdef FRAMERING_POSIX
+    if (!m_header)
+        return;
+    // readers that stay attached to the unlinked object would otherwise wait forever
+    m_header->closed.store(1, std::memory_order_release);
+    munmap(m_header, m_mappedSize);
+    shm_unlink(m_name.c_str());
+    m_header = nullptr;
+    m_mappedSize = 0;
+#endif
+}
+
+bool FrameRingWriter::publish(const uint8_t *pixels, uint32_t width, uint32_t height, uint32_t bytesPerLine,
+                              uint32_t pixelFormat, int64_t timestampUs, const Rect *rects, uint32_t rectCount)
+{
+    if (!m_header)
+        return false;
+    uint64_t dataSize = uint64_t(bytesPerLine) * height;
+    if (dataSize > m_header->maxFrameBytes) {
+        m_error = "frame does not fit into a ring slot";
+        return false;
+    }
+
+    uint64_t frameNumber = m_header->writeCount.load(std::memory_order_relaxed) + 1;
+    SlotHeader *slot = slotAt(m_header, (frameNumber - 1) % m_header->slotCount);
+    uint8_t *slotPixels = reinterpret_cast<uint8_t *>(slot) + slotHeaderSize();
+
+    slot->sequence.store(frameNumber * 2 - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot->frameNumber = frameNumber;
+    slot->timestampUs = timestampUs;
+    slot->width = width;
+    slot->height = height;
+    slot->bytesPerLine = bytesPerLine;
+    slot->pixelFormat = pixelFormat;
+    slot->dataSize = uint32_t(dataSize);
+    slot->rectCount = rectCount < MaxRects ? rectCount : MaxRects;
+    if (slot->rectCount)
+        memcpy(slot->rects, rects, slot->rectCount * sizeof(Rect));
+    memcpy(slotPixels, pixels, dataSize);
+
+    slot->sequence.store(frameNumber * 2, std::memory_order_release);
+    m_header->writeCount.store(frameNumber, std::memory_order_release);
+    return true;
+}
+
+FrameRingReader::~FrameRingReader()
+{
+    close();
+}
+
+bool FrameRingReader::open(const std::string &name)
+{
+    close();
+#ifdef FRAMERING_POSIX
+    int fd = shm_open(shmName(name).c_str(), O_RDONLY, 0);
+    if (fd < 0) {
+        m_error = std::string("shm_open failed: ") + strerror(errno);
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(RingHeader)) {
+        m_error = "shared memory object is not a frame ring";
+        ::close(fd);
+        return false;
+    }
+    void *memory = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (memory == MAP_FAILED) {
+        m_error = std::string("mmap failed: ") + strerror(errno);
+        return false;
+    }
+
+    const RingHeader *header = static_cast<const RingHeader *>(memory);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (header->magic != Magic || header->version != Version ||
+        alignUp(sizeof(RingHeader)) + header->slotCount * header->slotSize > uint64_t(info.st_size)) {
+        m_error = "shared memory object is not a compatible frame ring";
+        munmap(memory, info.st_size);
+        return false;
+    }
+    m_header = header;
+    m_mappedSize = info.st_size;
+    // start with whatever is newest, not with frames that are about to be overwritten
+    m_cursor = writeCount();
+    m_dropped = 0;
+    m_closed = false;
+    return true;
+#else
+    (void)name;
+    m_error = "shared memory frame rings are only supported on POSIX systems";
+    return false;
+#endif
+}
+
+void FrameRingReader::close()
+{
+#ifdef FRAMERING_POSIX
+    if (!m_header)
+        return;
+    munmap(const_cast<RingHeader *>(m_header), m_mappedSize);
+    m_header = nullptr;
+    m_mappedSize = 0;
+#endif
+}
+
+uint64_t FrameRingReader::writeCount() const
+{
+    return m_header ? m_header->writeCount.load(std::memory_order_acquire) : 0;
+}
+
+const SlotHeader *FrameRingReader::slot(uint64_t frameNumber) const
+{
+    return slotAt(m_header, (frameNumber - 1) % m_header->slotCount);
+}
+
+bool FrameRingReader::acquire(uint64_t frameNumber, FrameView &view) const
+{
+    if (!m_header || frameNumber == 0)
+        return false;
+    const SlotHeader *s = slot(frameNumber);
+    uint64_t sequence = s->sequence.load(std::memory_order_acquire);
+    if (sequence != frameNumber * 2)
+        return false;
+    view.slot = s;
+    view.pixels = reinterpret_cast<const uint8_t *>(s) + slotHeaderSize();
+    view.sequence = sequence;
+    return true;
+}
+
+bool FrameRingReader::acquireLatest(FrameView &view) const
+{
+    return acquire(writeCount(), view);
+}
+
+bool FrameRingReader::next(FrameView &view)
+{
+    if (!m_header)
+        return false;
+    // read the flag before the count, so frames published before closing are still returned
+    bool writerClosed = m_header->closed.load(std::memory_order_acquire) != 0;
+    uint64_t latest = writeCount();
+    while (m_cursor < latest) {
+        // the oldest slot is the next one the writer reuses, don't bother with it
+        uint64_t oldestSafe = latest > m_header->slotCount - 1 ? latest - (m_header->slotCount - 1) : 0;
+        if (m_cursor < oldestSafe) {
+            m_dropped += oldestSafe - m_cursor;
+            m_cursor = oldestSafe;
+        }
+        uint64_t frameNumber = m_cursor + 1;
+        m_cursor = frameNumber;
+        if (acquire(frameNumber, view))
+            return true;
+        m_dropped++;
+        latest = writeCount();
+    }
+    m_closed = writerClosed;
+    return false;
+}
+
+bool FrameRingReader::stillValid(const FrameView &view) const
+{
+    if (!view.slot)
+        return false;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return view.slot->sequence.load(std::memory_order_relaxed) == view.sequence;
+}
+
+} // namespace framering
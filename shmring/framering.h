@@ -0,0 +1,152 @@
+#ifndef FRAMERING_H
+#define FRAMERING_H
+
+// shared memory ring of processed frames plus their motion rectangles.
+// plain C++17 with no Qt dependency so other processes can link it directly.
+//
+// layout of the shared memory object:
+//
+//   RingHeader
+//   { SlotHeader, pixel data } * slotCount
+//
+// frame n (counting from 1) lives in slot (n - 1) % slotCount. each slot is
+// guarded by a sequence number: the writer sets it to 2n - 1 before touching
+// the slot and to 2n once the slot is complete. readers check the sequence
+// before and after looking at a slot, if both reads give 2n the data they saw
+// belongs to frame n. readers never lock or write anything, so any number of
+// them can follow the ring at their own pace, a reader that falls behind by
+// more than the ring size simply loses frames.
+//
+// the writer marks the header closed before it unlinks the ring, e.g. when it
+// needs bigger slots and starts a new ring under the same name. readers still
+// hold the old mapping then and have to open the name again to follow along.
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+namespace framering {
+
+constexpr uint32_t Magic = 0x474e524d; // "MRNG"
+constexpr uint32_t Version = 2;
+constexpr uint32_t MaxRects = 64;
+
+// the header and slots are shared between processes, which only works if the
+// atomics are plain memory without a hidden lock
+static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<uint32_t>::is_always_lock_free,
+              "frame ring needs lock free 32 and 64 bit atomics");
+
+enum PixelFormat : uint32_t
+{
+    PixelFormatXrgb32 = 1 // 0xffRRGGBB per pixel, native endian (QImage::Format_RGB32)
+};
+
+struct Rect
+{
+    int32_t x;
+    int32_t y;
+    int32_t width;
+    int32_t height;
+};
+
+struct RingHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    std::atomic<uint32_t> closed; // set once the writer has stopped publishing to this ring
+    uint64_t slotSize;       // bytes from one SlotHeader to the next
+    uint64_t maxFrameBytes;  // pixel bytes available per slot
+    alignas(64) std::atomic<uint64_t> writeCount; // number of frames published so far
+};
+
+struct SlotHeader
+{
+    std::atomic<uint64_t> sequence;
+    uint64_t frameNumber;
+    int64_t timestampUs;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bytesPerLine;
+    uint32_t pixelFormat;
+    uint32_t dataSize;
+    uint32_t rectCount;
+    Rect rects[MaxRects];
+};
+
+// a frame as it sits in shared memory, only trustworthy while stillValid() says so
+struct FrameView
+{
+    const SlotHeader *slot = nullptr;
+    const uint8_t *pixels = nullptr;
+    uint64_t sequence = 0;
+};
+
+class FrameRingWriter
+{
+public:
+    FrameRingWriter() = default;
+    ~FrameRingWriter();
+    FrameRingWriter(const FrameRingWriter &) = delete;
+    FrameRingWriter &operator=(const FrameRingWriter &) = delete;
+
+    bool create(const std::string &name, uint32_t slotCount, uint64_t maxFrameBytes);
+    void close();
+    bool isOpen() const { return m_header != nullptr; }
+    uint64_t maxFrameBytes() const { return m_header ? m_header->maxFrameBytes : 0; }
+    const std::string &errorString() const { return m_error; }
+
+    bool publish(const uint8_t *pixels, uint32_t width, uint32_t height, uint32_t bytesPerLine,
+                 uint32_t pixelFormat, int64_t timestampUs, const Rect *rects, uint32_t rectCount);
+
+private:
+    std::string m_name;
+    std::string m_error;
+    RingHeader *m_header = nullptr;
+    size_t m_mappedSize = 0;
+};
+
+class FrameRingReader
+{
+public:
+    FrameRingReader() = default;
+    ~FrameRingReader();
+    FrameRingReader(const FrameRingReader &) = delete;
+    FrameRingReader &operator=(const FrameRingReader &) = delete;
+
+    bool open(const std::string &name);
+    void close();
+    bool isOpen() const { return m_header != nullptr; }
+    const std::string &errorString() const { return m_error; }
+
+    uint64_t writeCount() const;
+    uint32_t slotCount() const { return m_header ? m_header->slotCount : 0; }
+    uint64_t maxFrameBytes() const { return m_header ? m_header->maxFrameBytes : 0; }
+
+    // look at frame n, fails if it has not been written yet or was already overwritten
+    bool acquire(uint64_t frameNumber, FrameView &view) const;
+    bool acquireLatest(FrameView &view) const;
+    // the frame after the last one this reader returned, skipping ahead if it fell behind.
+    // false when there is nothing new, check closed() to tell whether more can ever come
+    bool next(FrameView &view);
+    // the writer gave up on this ring and every frame in it has been returned
+    bool closed() const { return m_closed; }
+    // must be checked after using a view, false means the writer lapped us meanwhile
+    bool stillValid(const FrameView &view) const;
+
+    uint64_t droppedFrames() const { return m_dropped; }
+
+private:
+    const SlotHeader *slot(uint64_t frameNumber) const;
+
+    std::string m_error;
+    const RingHeader *m_header = nullptr;
+    size_t m_mappedSize = 0;
+    uint64_t m_cursor = 0;
+    uint64_t m_dropped = 0;
+    bool m_closed = false;
+};
+
+} // namespace framering
+
+#endif // FRAMERING_H
@@ -0,0 +1,13 @@
+TEMPLATE = app
+TARGET = framering_example
+CONFIG += console c++17
+CONFIG -= qt app_bundle
+
+SOURCES += \
+    framering.cpp \
+    example_reader.cpp
+
+HEADERS += \
+    framering.h
+
+unix:!macx: LIBS += -lrt
@@ -0,0 +1,15 @@
+QT += core gui testlib
+QT -= widgets
+CONFIG += c++17 testcase console
+CONFIG -= app_bundle
+
+TARGET = tst_motiondetector
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    tst_motiondetector.cpp \
+    ../../motiondetector.cpp
+
+HEADERS += \
+    ../../motiondetector.h
@@ -0,0 +1,389 @@
+// headless checks of MotionDetector on synthetic frames: moved squares,
+// a global brightness step, the grid options and motion estimation
+//
+//   cd tests/motiondetector && qmake && make check
+
+#include "motiondetector.h"
+
+#include <QtTest>
+#include <QSignalSpy>
+#include <QQueue>
+
+// the detector as it was before the fused pass and the summed area table,
+// kept verbatim (minus the frame bookkeeping) so the defaults can be held to it
+static QVector<QRect> baselineDetect(const QImage &previous, const QImage &current, int threshold, int sensitivity)
+{
+    QVector<QRect> motionRectangles;
+    QImage grayPrevious = previous.convertToFormat(QImage::Format_Grayscale8);
+    QImage grayCurrent = current.convertToFormat(QImage::Format_Grayscale8);
+    const int blockSize = 16;
+    const int width = grayCurrent.width();
+    const int height = grayCurrent.height();
+    QVector<QPoint> motionBlocks;
+    for (int y = 0; y < height; y += blockSize) {
+        for (int x = 0; x < width; x += blockSize) {
+            int diffSum = 0, pixelCount = 0;
+            for (int by = 0; by < blockSize && y + by < height; by++) {
+                const uchar *prevLine = grayPrevious.constScanLine(y + by);
+                const uchar *currLine = grayCurrent.constScanLine(y + by);
+                for (int bx = 0; bx < blockSize && x + bx < width; bx++) {
+                    int diff = qAbs(prevLine[x + bx] - currLine[x + bx]);
+                    diffSum += diff;
+                    pixelCount++;
+                }
+            }
+            float avgChange = pixelCount > 0 ? diffSum / (float)pixelCount : 0;
+            if (avgChange > threshold) {
+                motionBlocks.append(QPoint(x / blockSize, y / blockSize));
+            }
+        }
+    }
+
+    if (!motionBlocks.isEmpty()) {
+        QVector<int> labels(motionBlocks.size(), -1);
+        int nextLabel = 0;
+        for (int i = 0; i < motionBlocks.size(); i++) {
+            if (labels[i] >= 0)
+                continue;
+            QQueue<int> queue;
+            queue.enqueue(i);
+            labels[i] = nextLabel;
+            while (!queue.isEmpty()) {
+                int idx = queue.dequeue();
+                QPoint current = motionBlocks[idx];
+                for (int j = 0; j < motionBlocks.size(); j++) {
+                    if (labels[j] >= 0)
+                        continue;
+                    QPoint neighbor = motionBlocks[j];
+                    if (qAbs(neighbor.x() - current.x()) <= 1 && qAbs(neighbor.y() - current.y()) <= 1) {
+                        labels[j] = nextLabel;
+                        queue.enqueue(j);
+                    }
+                }
+            }
+            nextLabel++;
+        }
+
+        QVector<QVector<QPoint>> componentBlocks(nextLabel);
+        for (int i = 0; i < labels.size(); i++) {
+            if (labels[i] >= 0)
+                componentBlocks[labels[i]].append(motionBlocks[i]);
+        }
+        for (const QVector<QPoint> &component : componentBlocks) {
+            if (component.size() < sensitivity / 3)
+                continue;
+            int minX = width, minY = height, maxX = 0, maxY = 0;
+            for (const QPoint &p : component) {
+                minX = qMin(minX, p.x() * blockSize);
+                minY = qMin(minY, p.y() * blockSize);
+                maxX = qMax(maxX, (p.x() + 1) * blockSize);
+                maxY = qMax(maxY, (p.y() + 1) * blockSize);
+            }
+            QRect rect(qMax(0, minX), qMax(0, minY), qMin(width, maxX) - minX, qMin(height, maxY) - minY);
+            if (rect.width() > blockSize * 2 && rect.height() > blockSize * 2)
+                motionRectangles.append(rect);
+        }
+    }
+    return motionRectangles;
+}
+
+static void fillColour(QImage &image, const QRect &square, QRgb colour)
+{
+    const QRect area = square & image.rect();
+    for (int y = area.top(); y <= area.bottom(); y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = area.left(); x <= area.right(); x++)
+            line[x] = colour;
+    }
+}
+
+static void fillSquare(QImage &image, const QRect &square, int value)
+{
+    fillColour(image, square, qRgb(value, value, value));
+}
+
+// plain gray frame with a brighter square, gray keeps every luma formula exact
+static QImage sceneFrame(const QSize &size, int background, const QRect &square = QRect(), int foreground = 200)
+{
+    QImage image(size, QImage::Format_RGB32);
+    image.fill(qRgb(background, background, background));
+    fillSquare(image, square, foreground);
+    return image;
+}
+
+// 64x64 square with a bowl shaped gradient on a plain background, the texture
+// gives block matching a single best offset wherever the square moves
+static QImage texturedFrame(const QSize &size, const QPoint &topLeft)
+{
+    QImage image(size, QImage::Format_RGB32);
+    image.fill(qRgb(60, 60, 60));
+    for (int y = 0; y < 64; y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(topLeft.y() + y));
+        for (int x = 0; x < 64; x++) {
+            const int value = qMin(255, 30 + ((x - 32) * (x - 32) + (y - 32) * (y - 32)) / 8 + x);
+            line[topLeft.x() + x] = qRgb(value, value, value);
+        }
+    }
+    return image;
+}
+
+class TestMotionDetector : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void defaultsMatchBaseline_data();
+    void defaultsMatchBaseline();
+    void movedSquare();
+    void brightnessStepIsSceneChange();
+    void brightnessStepWhileIdle();
+    void colourfulSceneStaysIdle();
+    void gainCompensationKeepsMotion();
+    void shiftedGridCatchesBlockCorners();
+    void scalesBridgeGaps();
+    void motionEstimation_data();
+    void motionEstimation();
+};
+
+void TestMotionDetector::defaultsMatchBaseline_data()
+{
+    QTest::addColumn<QSize>("size");
+    QTest::newRow("aligned") << QSize(320, 240);
+    QTest::newRow("partial edge blocks") << QSize(330, 250);
+}
+
+void TestMotionDetector::defaultsMatchBaseline()
+{
+    QFETCH(QSize, size);
+    const QVector<QRect> path = { QRect(24, 40, 80, 80), QRect(24, 40, 80, 80), QRect(184, 120, 80, 80),
+                                  QRect(200, 150, 100, 90), QRect(10, 10, 70, 120), QRect(250, 170, 80, 80) };
+
+    MotionDetector detector;
+    QImage previous;
+    int framesWithMotion = 0;
+    for (const QRect &square : path) {
+        const QImage frame = sceneFrame(size, 60, square);
+        const QVector<QRect> rectangles = detector.detect(frame);
+        // the baseline compared its second frame against black, the detector
+        // now starts from the first frame instead, so only later frames compare
+        if (!previous.isNull()) {
+            QCOMPARE(rectangles, baselineDetect(previous, frame, 20, 50));
+            if (!rectangles.isEmpty())
+                framesWithMotion++;
+        }
+        previous = frame;
+    }
+    QCOMPARE(framesWithMotion, path.size() - 2);
+}
+
+void TestMotionDetector::movedSquare()
+{
+    MotionDetector detector;
+    QSignalSpy sceneSpy(&detector, &MotionDetector::sceneChanged);
+    const QSize size(320, 240);
+
+    QVERIFY(detector.detect(sceneFrame(size, 60, QRect(24, 40, 80, 80))).isEmpty());
+    QVERIFY(detector.detect(sceneFrame(size, 60, QRect(24, 40, 80, 80))).isEmpty());
+    // where it left and where it arrived, snapped to the 16 pixel grid
+    const QVector<QRect> expected = { QRect(16, 32, 96, 96), QRect(176, 112, 96, 96) };
+    QCOMPARE(detector.detect(sceneFrame(size, 60, QRect(184, 120, 80, 80))), expected);
+    QCOMPARE(sceneSpy.count(), 0);
+}
+
+void TestMotionDetector::brightnessStepIsSceneChange()
+{
+    MotionDetector detector;
+    QSignalSpy sceneSpy(&detector, &MotionDetector::sceneChanged);
+    const QSize size(320, 240);
+    const QRect square(24, 40, 80, 80);
+
+    detector.detect(sceneFrame(size, 60, square));
+    QVERIFY(detector.detect(sceneFrame(size, 140, square)).isEmpty());
+    QCOMPARE(sceneSpy.count(), 1);
+    const QList<QVariant> arguments = sceneSpy.takeFirst();
+    QVERIFY(arguments.at(0).toDouble() > 0.6);
+    // the background rose by 80, the square stayed put
+    QCOMPARE(qRound(arguments.at(1).toDouble()), qRound(80.0 * (1.0 - 80.0 * 80 / (320 * 240))));
+
+    // the new lighting is the reference from here on, motion still counts
+    QVERIFY(detector.detect(sceneFrame(size, 140, square)).isEmpty());
+    QCOMPARE(detector.detect(sceneFrame(size, 140, QRect(184, 120, 80, 80))).size(), 2);
+    QCOMPARE(sceneSpy.count(), 0);
+
+    // with the check disabled the step is reported as motion everywhere
+    MotionDetector unchecked;
+    QSignalSpy uncheckedSpy(&unchecked, &MotionDetector::sceneChanged);
+    unchecked.setSceneChangeFraction(0);
+    unchecked.detect(sceneFrame(size, 60, square));
+    QCOMPARE(unchecked.detect(sceneFrame(size, 140, square)), QVector<QRect>{ QRect(0, 0, 320, 240) });
+    QCOMPARE(uncheckedSpy.count(), 0);
+}
+
+void TestMotionDetector::brightnessStepWhileIdle()
+{
+    MotionDetector detector;
+    QSignalSpy sceneSpy(&detector, &MotionDetector::sceneChanged);
+    const QSize size(320, 240);
+    const QRect square(24, 40, 80, 80);
+
+    detector.setLowPowerEnabled(true);
+    detector.setIdleTimeout(0);
+    detector.detect(sceneFrame(size, 60, square));
+    QTest::qSleep(5);
+    detector.detect(sceneFrame(size, 60, square));
+    QVERIFY(detector.isIdle());
+
+    QVERIFY(detector.detect(sceneFrame(size, 140, square)).isEmpty());
+    QCOMPARE(sceneSpy.count(), 1);
+    const double meanLumaShift = sceneSpy.first().at(1).toDouble();
+    QVERIFY2(qAbs(meanLumaShift - 80.0 * (1.0 - 80.0 * 80 / (320 * 240))) < 2.0,
+             qPrintable(QString::number(meanLumaShift)));
+    QVERIFY(detector.isIdle());
+}
+
+void TestMotionDetector::colourfulSceneStaysIdle()
+{
+    // saturated colours are where luma formulas disagree the most, the idle
+    // samples have to come out the same as the full resolution reference
+    QImage frame(320, 240, QImage::Format_RGB32);
+    frame.fill(qRgb(0, 255, 0));
+    fillColour(frame, QRect(40, 40, 120, 80), qRgb(255, 0, 0));
+    fillColour(frame, QRect(180, 150, 120, 80), qRgb(0, 0, 255));
+
+    MotionDetector detector;
+    QSignalSpy sceneSpy(&detector, &MotionDetector::sceneChanged);
+    QSignalSpy idleSpy(&detector, &MotionDetector::idleChanged);
+    detector.setLowPowerEnabled(true);
+    detector.setIdleTimeout(0);
+    detector.detect(frame);
+    QTest::qSleep(5);
+    detector.detect(frame);
+    QVERIFY(detector.isIdle());
+
+    for (int i = 0; i < 3; i++)
+        QVERIFY(detector.detect(frame).isEmpty());
+    QVERIFY(detector.isIdle());
+    QCOMPARE(idleSpy.count(), 1);
+    QCOMPARE(sceneSpy.count(), 0);
+
+    // real motion still wakes it up
+    QImage moved = frame;
+    fillColour(moved, QRect(200, 40, 80, 80), qRgb(255, 255, 255));
+    QCOMPARE(detector.detect(moved).size(), 1);
+    QVERIFY(!detector.isIdle());
+}
+
+void TestMotionDetector::gainCompensationKeepsMotion()
+{
+    // exposure up by half while the square moves
+    const QSize size(320, 240);
+    const QImage before = sceneFrame(size, 80, QRect(24, 40, 80, 80), 120);
+    const QImage after = sceneFrame(size, 120, QRect(184, 120, 80, 80), 250);
+
+    MotionDetector plain;
+    QSignalSpy plainSpy(&plain, &MotionDetector::sceneChanged);
+    plain.detect(before);
+    QVERIFY(plain.detect(after).isEmpty());
+    QCOMPARE(plainSpy.count(), 1);
+
+    MotionDetector compensated;
+    QSignalSpy compensatedSpy(&compensated, &MotionDetector::sceneChanged);
+    compensated.setGainCompensationEnabled(true);
+    compensated.detect(before);
+    const QVector<QRect> expected = { QRect(16, 32, 96, 96), QRect(176, 112, 96, 96) };
+    QCOMPARE(compensated.detect(after), expected);
+    QCOMPARE(compensatedSpy.count(), 0);
+}
+
+void TestMotionDetector::shiftedGridCatchesBlockCorners()
+{
+    // a faint 40x40 patch fully covers a 2x2 group of plain blocks, but the
+    // resulting 32 pixel box is not wider than two blocks and is dropped,
+    // the half block grid lines up with the patch and reports all of it
+    const QSize size(320, 240);
+    const QImage empty = sceneFrame(size, 60);
+    const QImage patch = sceneFrame(size, 60, QRect(40, 40, 40, 40), 100);
+
+    MotionDetector plain;
+    plain.setSensitivity(3);
+    plain.detect(empty);
+    QVERIFY(plain.detect(patch).isEmpty());
+
+    MotionDetector shifted;
+    shifted.setSensitivity(3);
+    shifted.setShiftedGridEnabled(true);
+    shifted.detect(empty);
+    QCOMPARE(shifted.detect(patch), QVector<QRect>{ QRect(40, 40, 40, 40) });
+}
+
+void TestMotionDetector::scalesBridgeGaps()
+{
+    // two squares a block apart are separate at one scale, the double size
+    // blocks spanning the gap join them
+    const QSize size(320, 240);
+    const QImage empty = sceneFrame(size, 60);
+    QImage squares = sceneFrame(size, 60, QRect(32, 32, 48, 48));
+    fillSquare(squares, QRect(96, 32, 48, 48), 200);
+
+    MotionDetector single;
+    single.setSensitivity(3);
+    single.detect(empty);
+    const QVector<QRect> separate = { QRect(32, 32, 48, 48), QRect(96, 32, 48, 48) };
+    QCOMPARE(single.detect(squares), separate);
+
+    MotionDetector multiScale;
+    multiScale.setSensitivity(3);
+    multiScale.setScales({ 1, 2 });
+    multiScale.detect(empty);
+    QCOMPARE(multiScale.detect(squares), QVector<QRect>{ QRect(32, 32, 128, 64) });
+}
+
+void TestMotionDetector::motionEstimation_data()
+{
+    QTest::addColumn<QPoint>("shift");
+    QTest::newRow("right and up") << QPoint(5, -3);
+    QTest::newRow("left and down") << QPoint(-7, 6);
+    QTest::newRow("diagonal") << QPoint(4, 4);
+}
+
+void TestMotionDetector::motionEstimation()
+{
+    // vectors point the way the content moved, not where the match was found
+    QFETCH(QPoint, shift);
+    const QSize size(320, 240);
+    const QPoint origin(96, 80);
+
+    MotionDetector detector;
+    detector.setSensitivity(3);
+    detector.setMotionEstimationEnabled(true);
+    detector.detect(texturedFrame(size, origin));
+    const QVector<QRect> rectangles = detector.detect(texturedFrame(size, origin + shift));
+    QCOMPARE(rectangles.size(), 1);
+    QCOMPARE(detector.rectangleMotion().size(), 1);
+    const QPointF motion = detector.rectangleMotion().first();
+    QVERIFY2(qAbs(motion.x() - shift.x()) < 0.5 && qAbs(motion.y() - shift.y()) < 0.5,
+             qPrintable(QString("%1,%2").arg(motion.x()).arg(motion.y())));
+
+    // the flat middle of the bowl can settle a pixel or two off, but never
+    // the wrong way and only for a few blocks
+    const QVector<QPoint> &field = detector.motionVectorField();
+    const QVector<bool> &valid = detector.motionVectorValid();
+    const int columns = detector.motionFieldColumns();
+    QCOMPARE(field.size(), valid.size());
+    int estimated = 0, exact = 0;
+    for (int i = 0; i < field.size(); i++) {
+        if (!valid[i])
+            continue;
+        estimated++;
+        QVERIFY(rectangles.first().intersects(QRect((i % columns) * 16, (i / columns) * 16, 16, 16)));
+        QVERIFY(field[i].x() * shift.x() > 0 && field[i].y() * shift.y() > 0);
+        if (field[i] == shift)
+            exact++;
+    }
+    QVERIFY(estimated > 0);
+    QVERIFY2(exact * 4 >= estimated * 3, qPrintable(QString("%1 of %2").arg(exact).arg(estimated)));
+}
+
+QTEST_GUILESS_MAIN(TestMotionDetector)
+
+#include "tst_motiondetector.moc"
@@ -0,0 +1,18 @@
+QT += core gui multimedia testlib
+QT -= widgets
+CONFIG += c++17 testcase console
+CONFIG -= app_bundle
+
+TARGET = tst_rawframefile
+
+INCLUDEPATH += ../..
+
+SOURCES += \
+    tst_rawframefile.cpp \
+    ../../rawframefile.cpp \
+    ../../replaysource.cpp
+
+HEADERS += \
+    ../../framesource.h \
+    ../../rawframefile.h \
+    ../../replaysource.h
@@ -0,0 +1,203 @@
+// round trip of RawFrameWriter dumps through ReplaySource: frame count,
+// timestamps, pixels, seeking and recovery of damaged files
+//
+//   cd tests/rawframefile && qmake && make check
+
+#include "rawframefile.h"
+#include "replaysource.h"
+
+#include <QtTest>
+#include <QSignalSpy>
+#include <QTemporaryDir>
+#include <QGuiApplication>
+
+static const int FrameCount = 5;
+static const qint64 FrameIntervalUs = 40000;
+
+// every frame gets its own pattern so a mixed up or shifted frame shows
+static QImage testFrame(int index)
+{
+    QImage image(64, 48, QImage::Format_RGB32);
+    for (int y = 0; y < image.height(); y++) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        for (int x = 0; x < image.width(); x++)
+            line[x] = qRgb((x * 4 + index * 40) & 0xff, (y * 5) & 0xff, index * 50);
+    }
+    return image;
+}
+
+struct ReplayedFrame
+{
+    qint64 timestampUs;
+    QImage image;
+};
+
+// runs the whole dump as fast as possible and keeps a copy of every frame
+static QVector<ReplayedFrame> replayAll(ReplaySource &source)
+{
+    QVector<ReplayedFrame> frames;
+    QMetaObject::Connection connection = QObject::connect(&source, &FrameSource::frameAvailable,
+                                                          [&frames](const QVideoFrame &frame) {
+        QVideoFrame mapped = frame;
+        if (!mapped.map(QVideoFrame::ReadOnly))
+            return;
+        // the replayed frames point into the mapped file, copy before it moves on
+        QImage image(mapped.width(), mapped.height(), QImage::Format_RGB32);
+        for (int y = 0; y < image.height(); y++)
+            memcpy(image.scanLine(y), mapped.bits(0) + y * mapped.bytesPerLine(0), image.width() * 4);
+        mapped.unmap();
+        frames.append({ frame.startTime(), image });
+    });
+    QSignalSpy finishedSpy(&source, &FrameSource::finished);
+    source.setRealTime(false);
+    source.start();
+    finishedSpy.wait(5000);
+    QObject::disconnect(connection);
+    return frames;
+}
+
+class TestRawFrameFile : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void roundTrip();
+    void seek();
+    void missingFooterIsRecovered();
+    void truncatedRecordIsDropped();
+    void corruptRecordIsRejected();
+
+private:
+    QByteArray dumpBytes() const;
+    QString writeDump(const QString &name, const QByteArray &bytes) const;
+
+    QTemporaryDir m_dir;
+    QString m_dumpPath;
+};
+
+void TestRawFrameFile::initTestCase()
+{
+    QVERIFY(m_dir.isValid());
+    m_dumpPath = m_dir.filePath("frames.raw");
+
+    RawFrameWriter writer;
+    QVERIFY2(writer.open(m_dumpPath), qPrintable(writer.errorString()));
+    for (int i = 0; i < FrameCount; i++) {
+        QVideoFrame frame(testFrame(i));
+        frame.setStartTime(i * FrameIntervalUs);
+        writer.writeFrame(frame);
+    }
+    QCOMPARE(writer.frameCount(), FrameCount);
+    writer.close();
+}
+
+QByteArray TestRawFrameFile::dumpBytes() const
+{
+    QFile file(m_dumpPath);
+    if (!file.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return file.readAll();
+}
+
+QString TestRawFrameFile::writeDump(const QString &name, const QByteArray &bytes) const
+{
+    const QString path = m_dir.filePath(name);
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(bytes) != bytes.size())
+        return QString();
+    return path;
+}
+
+void TestRawFrameFile::roundTrip()
+{
+    ReplaySource source;
+    QVERIFY2(source.open(m_dumpPath), qPrintable(source.errorString()));
+    QCOMPARE(source.frameCount(), FrameCount);
+
+    const QVector<ReplayedFrame> frames = replayAll(source);
+    QCOMPARE(frames.size(), FrameCount);
+    for (int i = 0; i < FrameCount; i++) {
+        QCOMPARE(frames[i].timestampUs, i * FrameIntervalUs);
+        QCOMPARE(frames[i].image, testFrame(i));
+    }
+}
+
+void TestRawFrameFile::seek()
+{
+    ReplaySource source;
+    QVERIFY(source.open(m_dumpPath));
+    QVERIFY(!source.seek(FrameCount));
+    QVERIFY(!source.seek(-1));
+    QVERIFY(source.seek(3));
+    QCOMPARE(source.position(), 3);
+
+    const QVector<ReplayedFrame> frames = replayAll(source);
+    QCOMPARE(frames.size(), FrameCount - 3);
+    QCOMPARE(frames.first().timestampUs, 3 * FrameIntervalUs);
+    QCOMPARE(frames.first().image, testFrame(3));
+}
+
+void TestRawFrameFile::missingFooterIsRecovered()
+{
+    // a writer that crashed never wrote the index or the footer
+    QByteArray bytes = dumpBytes();
+    const RawFrameFileFooter *footer =
+        reinterpret_cast<const RawFrameFileFooter *>(bytes.constData() + bytes.size() - sizeof(RawFrameFileFooter));
+    bytes.truncate(footer->indexOffset);
+
+    ReplaySource source;
+    const QString path = writeDump("nofooter.raw", bytes);
+    QVERIFY2(source.open(path), qPrintable(source.errorString()));
+    QCOMPARE(source.frameCount(), FrameCount);
+    const QVector<ReplayedFrame> frames = replayAll(source);
+    QCOMPARE(frames.size(), FrameCount);
+    QCOMPARE(frames.last().image, testFrame(FrameCount - 1));
+
+    // only the footer itself lost, the index in front of it must not be taken for a record
+    bytes = dumpBytes();
+    bytes.chop(sizeof(RawFrameFileFooter));
+    QVERIFY(source.open(writeDump("nofootermagic.raw", bytes)));
+    QCOMPARE(source.frameCount(), FrameCount);
+}
+
+void TestRawFrameFile::truncatedRecordIsDropped()
+{
+    // cut in the middle of the last frame's pixels
+    QByteArray bytes = dumpBytes();
+    const RawFrameFileFooter *footer =
+        reinterpret_cast<const RawFrameFileFooter *>(bytes.constData() + bytes.size() - sizeof(RawFrameFileFooter));
+    bytes.truncate(footer->indexOffset - 100);
+
+    ReplaySource source;
+    QVERIFY(source.open(writeDump("truncated.raw", bytes)));
+    QCOMPARE(source.frameCount(), FrameCount - 1);
+}
+
+void TestRawFrameFile::corruptRecordIsRejected()
+{
+    // a record claiming more rows than its data holds must not reach QImage
+    QByteArray bytes = dumpBytes();
+    const RawFrameFileFooter *footer =
+        reinterpret_cast<const RawFrameFileFooter *>(bytes.constData() + bytes.size() - sizeof(RawFrameFileFooter));
+    const quint64 *offsets = reinterpret_cast<const quint64 *>(bytes.constData() + footer->indexOffset);
+    const quint64 offset = offsets[2];
+    RawFrameRecordHeader *record = reinterpret_cast<RawFrameRecordHeader *>(bytes.data() + offset);
+    record->height *= 2;
+
+    ReplaySource source;
+    QVERIFY(source.open(writeDump("corrupt.raw", bytes)));
+    QCOMPARE(source.frameCount(), 2);
+}
+
+int main(int argc, char *argv[])
+{
+    // QVideoFrame::toImage() in the writer wants a gui application, but no display
+    if (!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QGuiApplication app(argc, argv);
+    TestRawFrameFile test;
+    return QTest::qExec(&test, argc, argv);
+}
+
+#include "tst_rawframefile.moc"